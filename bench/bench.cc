@@ -0,0 +1,299 @@
+/*
+ * Benchmark addon for V8U. Build it with `node-gyp rebuild` from this
+ * directory, then run the scripts next to it.
+ */
+
+#include <cstdlib>
+#include <new>
+
+#include "version.hpp"
+
+using namespace v8u;
+
+// C++ heap allocations made from this addon (linked with -Bsymbolic, so
+// only our own calls to operator new end up here)
+
+static double allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* ptr = std::malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+void operator delete(void* ptr) throw() {
+  std::free(ptr);
+}
+void operator delete[](void* ptr) throw() {
+  std::free(ptr);
+}
+
+V8_CB(Allocations) {
+  V8_RET(Num(allocations));
+} V8_CB_END()
+
+// What hand-written code has to do on each V8 version
+
+#if NODE_VERSION_AT_LEAST(0,11,8)
+  #define RAW_CB(ID) void ID(const v8::FunctionCallbackInfo<v8::Value>& info)
+  #define RAW_RETURN(VALUE) {info.GetReturnValue().Set(VALUE); return;}
+  #define RAW_THROW(VALUE) {V8_STHROW_NR(VALUE); return;}
+#else
+  #define RAW_CB(ID) v8::Handle<v8::Value> ID(const v8::Arguments& info)
+  #define RAW_RETURN(VALUE) return scope.Close(VALUE)
+  #define RAW_THROW(VALUE) return v8::ThrowException(VALUE)
+#endif
+
+// Callbacks
+
+RAW_CB(RawNoop) {
+  V8_HANDLE_SCOPE(scope);
+  RAW_RETURN(v8::Undefined());
+}
+V8_CB(Noop) {
+} V8_CB_END()
+
+RAW_CB(RawAdd) {
+  V8_HANDLE_SCOPE(scope);
+  if (info.Length() < 2 || !info[0]->IsNumber() || !info[1]->IsNumber())
+    RAW_THROW(v8::Exception::TypeError(v8::String::New("Expected numbers.")));
+  RAW_RETURN(v8::Number::New(info[0]->NumberValue() + info[1]->NumberValue()));
+}
+V8_CB(Add) {
+  V8_CHECK(CheckArguments(2, info));
+  if (!info[0]->IsNumber() || !info[1]->IsNumber())
+    V8_FAIL(TypeErr("Expected numbers."));
+  V8_RET(Num(Num(info[0]) + Num(info[1])));
+} V8_CB_END()
+
+double AddNumbers(double a, double b) {
+  return a + b;
+}
+
+// Unwrap / HasInstance
+
+RAW_CB(RawUnwrap) {
+  V8_HANDLE_SCOPE(scope);
+  if (!Version::templ_->HasInstance(info[0]))
+    RAW_THROW(v8::Exception::TypeError(v8::String::New("Not a Version.")));
+  Version* version = node::ObjectWrap::Unwrap<Version>(info[0]->ToObject());
+  RAW_RETURN(v8::Integer::New(version->getMajor()));
+}
+V8_CB(UnwrapVersion) {
+  Version* version = Version::Unwrap(Obj(info[0]));
+  V8_CHECK(version);
+  V8_RET(Int(version->getMajor()));
+} V8_CB_END()
+
+// Wrapped() objects
+
+RAW_CB(RawWrapped) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Handle<v8::Value> args [3] = {info[0], info[0], info[0]};
+  RAW_RETURN(Version::templ_->GetFunction()->NewInstance(3, args));
+}
+V8_CB(Wrapped) {
+  int major = Int(info[0]);
+  V8_RET((new Version(major, major, major))->Wrapped());
+} V8_CB_END()
+
+// Errors
+
+RAW_CB(RawThrow) {
+  V8_HANDLE_SCOPE(scope);
+  RAW_THROW(v8::Exception::TypeError(v8::String::New("Nope.")));
+}
+V8_CB(Throw) {
+  V8_THROW(TypeErr("Nope."));
+} V8_CB_END()
+V8_CB(Fail) {
+  V8_FAIL(TypeErr("Nope."));
+} V8_CB_END()
+
+// Strings
+
+RAW_CB(RawStr) {
+  V8_HANDLE_SCOPE(scope);
+  RAW_RETURN(v8::String::New("hello, world"));
+}
+V8_CB(MakeStr) {
+  V8_RET(Str("hello, world"));
+} V8_CB_END()
+
+RAW_CB(RawSymbol) {
+  V8_HANDLE_SCOPE(scope);
+  RAW_RETURN(v8::String::NewSymbol("hello"));
+}
+V8_CB(MakeSymbol) {
+  V8_RET(Symbol("hello"));
+} V8_CB_END()
+V8_CB(CachedSymbol) {
+  V8_RET(V8U_SYMBOL("hello"));
+} V8_CB_END()
+
+RAW_CB(RawUtf8) {
+  V8_HANDLE_SCOPE(scope);
+  v8::String::Utf8Value str (info[0]);
+  RAW_RETURN(v8::Integer::New(str.length()));
+}
+V8_CB(ReadUtf8) {
+  Utf8 str (info[0]);
+  V8_RET(Int(int64_t(str.length())));
+} V8_CB_END()
+
+// Persistent handles
+
+RAW_CB(RawPersistent) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Persistent<v8::Value> a = v8::Persistent<v8::Value>::New(info[0]);
+  v8::Persistent<v8::Value> b = v8::Persistent<v8::Value>::New(a);
+  a.Dispose();
+  b.Dispose();
+  RAW_RETURN(v8::Undefined());
+}
+V8_CB(CopyPersisted) {
+  Persisted<v8::Value> a (info[0]);
+  Persisted<v8::Value> b (a);
+  Persisted<v8::Value> c;
+  c = b;
+} V8_CB_END()
+
+// Arrays: element by element vs. ToVector / FromVector
+
+#if __cplusplus >= 201103L
+RAW_CB(RawSumArray) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Local<v8::Array> array = v8::Local<v8::Array>::Cast(info[0]);
+  std::vector<double> items;
+  for (uint32_t i = 0; i < array->Length(); i++)
+    items.push_back(array->Get(i)->NumberValue());
+  double sum = 0;
+  for (size_t i = 0; i < items.size(); i++) sum += items[i];
+  RAW_RETURN(v8::Number::New(sum));
+}
+V8_CB(SumArray) {
+  std::vector<double> items;
+  if (!v8u::ToVector(info[0], items)) V8_STHROW(v8u::TypeErr("Array expected"));
+  double sum = 0;
+  for (size_t i = 0; i < items.size(); i++) sum += items[i];
+  V8_RET(Num(sum));
+} V8_CB_END()
+
+static std::vector<double> Numbers (1000, 0.5);
+
+RAW_CB(RawMakeArray) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Local<v8::Array> array = v8::Array::New();
+  for (size_t i = 0; i < Numbers.size(); i++)
+    array->Set(i, v8::Number::New(Numbers[i]));
+  RAW_RETURN(array);
+}
+V8_CB(MakeArray) {
+  V8_RET(v8u::FromVector(Numbers));
+} V8_CB_END()
+
+// Streaming: one big array vs. a Cursor
+
+static const uint32_t Rows = 100000;
+
+RAW_CB(RawRows) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Local<v8::Array> rows = v8::Array::New(Rows);
+  for (uint32_t i = 0; i < Rows; i++) rows->Set(i, v8::Number::New(i * 0.5));
+  RAW_RETURN(rows);
+}
+V8_CB(CursorRows) {
+  uint32_t i = 0;
+  V8_RET(v8u::Cursor::Generate<double>([i](double& row) mutable {
+    if (i == Rows) return false;
+    row = i++ * 0.5;
+    return true;
+  }));
+} V8_CB_END()
+#endif
+
+// Per-instance memory: methods on the prototype vs. on every instance
+
+//// Methods defined with V8_DEF_CB, like Version
+class ProtoMethods : public node::ObjectWrap {
+public:
+  V8_CTOR() {
+    V8_WRAP(new ProtoMethods);
+  } V8_CTOR_END()
+
+  static V8_CB(Noop) {
+  } V8_CB_END()
+
+  NODE_TYPE(ProtoMethods, "ProtoMethods") {
+    V8_DEF_CB("toString", Noop);
+    V8_DEF_CB("toArray", Noop);
+    V8_DEF_CB("inspect", Noop);
+  } NODE_TYPE_END()
+};
+V8_POST_TYPE(ProtoMethods)
+
+//// The same methods, set on the instance template
+class OwnMethods : public node::ObjectWrap {
+public:
+  V8_CTOR() {
+    V8_WRAP(new OwnMethods);
+  } V8_CTOR_END()
+
+  static V8_CB(Noop) {
+  } V8_CB_END()
+
+  NODE_TYPE(OwnMethods, "OwnMethods") {
+    inst->Set(V8U_SYMBOL("toString"), Func(Noop));
+    inst->Set(V8U_SYMBOL("toArray"), Func(Noop));
+    inst->Set(V8U_SYMBOL("inspect"), Func(Noop));
+  } NODE_TYPE_END()
+};
+V8_POST_TYPE(OwnMethods)
+
+#define BENCH_DEF(NAME, FUNCTION)                                              \
+  target->Set(V8U_SYMBOL(NAME), Func(FUNCTION))
+
+NODE_DEF_MAIN() {
+  Version::init(target);
+  VersionRange::init(target);
+  ProtoMethods::init(target);
+  OwnMethods::init(target);
+
+  BENCH_DEF("allocations", Allocations);
+
+  BENCH_DEF("rawNoop", RawNoop);
+  BENCH_DEF("noop", Noop);
+  BENCH_DEF("rawAdd", RawAdd);
+  BENCH_DEF("add", Add);
+#if __cplusplus >= 201103L
+  BENCH_DEF("bindAdd", V8_BIND(AddNumbers));
+  BENCH_DEF("fastAdd", V8_FAST_BIND(AddNumbers));
+#endif
+  BENCH_DEF("rawUnwrap", RawUnwrap);
+  BENCH_DEF("unwrap", UnwrapVersion);
+  BENCH_DEF("rawWrapped", RawWrapped);
+  BENCH_DEF("wrapped", Wrapped);
+  BENCH_DEF("rawThrow", RawThrow);
+  BENCH_DEF("throw", Throw);
+  BENCH_DEF("fail", Fail);
+  BENCH_DEF("rawStr", RawStr);
+  BENCH_DEF("str", MakeStr);
+  BENCH_DEF("rawSymbol", RawSymbol);
+  BENCH_DEF("symbol", MakeSymbol);
+  BENCH_DEF("cachedSymbol", CachedSymbol);
+  BENCH_DEF("rawUtf8", RawUtf8);
+  BENCH_DEF("utf8", ReadUtf8);
+  BENCH_DEF("rawPersistent", RawPersistent);
+  BENCH_DEF("persisted", CopyPersisted);
+#if __cplusplus >= 201103L
+  BENCH_DEF("rawSumArray", RawSumArray);
+  BENCH_DEF("sumArray", SumArray);
+  BENCH_DEF("rawMakeArray", RawMakeArray);
+  BENCH_DEF("makeArray", MakeArray);
+  BENCH_DEF("rawRows", RawRows);
+  BENCH_DEF("cursorRows", CursorRows);
+#endif
+} NODE_DEF_MAIN_END(bench)
@@ -0,0 +1,209 @@
+// Microbenchmarks: v8u constructs against the same thing in plain V8.
+//
+// Usage: node --expose-gc bench.js [options] [filter]
+//   --runs N          timed runs per case, best one is kept (default 5)
+//   --time MS         target duration of each run (default 200)
+//   --save FILE       write results as JSON, to use as a baseline later
+//   --check FILE      compare against a saved baseline and exit with 1 if
+//                     any case got slower than --tolerance or allocates more
+//   --tolerance X     allowed slowdown, as a fraction (default 0.15)
+
+var fs = require('fs');
+var bench = require('./build/Release/bench');
+
+var options = {runs: 5, time: 200, tolerance: 0.15, save: null, check: null, filter: null};
+var argv = process.argv.slice(2);
+for (var i = 0; i < argv.length; i++) {
+  var arg = argv[i];
+  if (arg.slice(0, 2) !== '--') options.filter = new RegExp(arg);
+  else options[arg.slice(2)] = argv[++i];
+}
+options.runs = +options.runs;
+options.time = +options.time;
+options.tolerance = +options.tolerance;
+
+if (typeof gc !== 'function') {
+  console.error('Run with --expose-gc');
+  process.exit(1);
+}
+
+// Every case gets its own loop, so that call sites stay monomorphic
+function loop(body) {
+  return new Function('bench', 'v', 'n',
+      'var r; for (var i = 0; i < n; i++) { ' + body + ' } return r;');
+}
+function call(method, arg) {
+  return loop('r = bench.' + method + '(' + (arg || '') + ');');
+}
+function fails(method) {
+  return loop('try { bench.' + method + '(); } catch (e) { r = e; }');
+}
+
+var version = new bench.Version(1, 2, 3);
+var values = {
+  version: version,
+  short: 'hello, world',
+  long: new Array(1025).join('é'),
+  array: [],
+  typed: new Float64Array(1000),
+  range: {version: version, range: new bench.VersionRange('^1.2 || >=3 <4')}
+};
+for (var i = 0; i < 1000; i++) values.array.push(values.typed[i] = i / 2);
+
+// A thousand versions, as a manifest index would have them
+var list = [];
+for (var i = 0; i < 1000; i++) list.push((i % 7) + '.' + (i % 13) + '.' + i);
+values.versions = {
+  list: list,
+  buffer: new Buffer(list.join('\n')),
+  keys: bench.Version.parseAll(list),
+  range: new bench.VersionRange('^1.2 || >=3 <4')
+};
+
+var cases = [
+  ['callback: raw',            call('rawNoop')],
+  ['callback: V8_CB',          call('noop')],
+  ['numbers: raw',             call('rawAdd', '1, 2')],
+  ['numbers: V8_CB',           call('add', '1, 2')],
+  ['numbers: V8_BIND',         call('bindAdd', '1, 2'), 'bindAdd'],
+  ['numbers: V8_FAST_BIND',    call('fastAdd', '1, 2'), 'fastAdd'],
+  ['unwrap: raw HasInstance',  call('rawUnwrap', 'v')],
+  ['unwrap: Unwrap',           call('unwrap', 'v')],
+  ['create: raw constructor',  call('rawWrapped', '1')],
+  ['create: Wrapped()',        call('wrapped', '1')],
+  ['error: raw',               fails('rawThrow')],
+  ['error: V8_THROW',          fails('throw')],
+  ['error: V8_FAIL',           fails('fail')],
+  ['string: raw',              call('rawStr')],
+  ['string: Str',              call('str')],
+  ['symbol: raw',              call('rawSymbol')],
+  ['symbol: Symbol',           call('symbol')],
+  ['symbol: V8_SYMBOL',        call('cachedSymbol')],
+  ['read short: Utf8Value',    call('rawUtf8', 'v')],
+  ['read short: Utf8',         call('utf8', 'v')],
+  ['read long: Utf8Value',     call('rawUtf8', 'v')],
+  ['read long: Utf8',          call('utf8', 'v')],
+  ['persistent: raw',          call('rawPersistent', 'v')],
+  ['persistent: Persisted',    call('persisted', 'v')],
+  ['read array: raw',          call('rawSumArray', 'v'), 'rawSumArray'],
+  ['read array: ToVector',     call('sumArray', 'v'), 'sumArray'],
+  ['read typed: ToVector',     call('sumArray', 'v'), 'sumArray'],
+  ['make array: raw',          call('rawMakeArray'), 'rawMakeArray'],
+  ['make array: FromVector',   call('makeArray'), 'makeArray'],
+  ['stream 100k: raw array',   loop('var rows = bench.rawRows(); ' +
+                                     'for (var j = 0; j < rows.length; j++) r = rows[j];'), 'rawRows'],
+  ['stream 100k: Cursor',      loop('var it = bench.cursorRows(), x; ' +
+                                    'while (!(x = it.next()).done) r = x.value;'), 'cursorRows'],
+  ['Version: get',             loop('r = v.major;')],
+  ['Version: set',             loop('v.minor = i & 0xFFFF;')],
+  ['Version: toString',        loop('r = v.toString();')],
+  ['Version: compare',         loop('r = v.compare(v);')],
+  ['range: test',              loop('r = v.range.test(v.version);')],
+  ['range: satisfies string',  loop('r = v.version.satisfies("^1.2 || >=3 <4");')],
+  ['versions: new Version x1k', loop('for (var j = 0; j < v.list.length; j++) { ' +
+                                     'var p = v.list[j].split("."); ' +
+                                     'r = new bench.Version(+p[0], +p[1], +p[2]); }')],
+  ['versions: parseAll array',  loop('r = bench.Version.parseAll(v.list);')],
+  ['versions: parseAll Buffer', loop('r = bench.Version.parseAll(v.buffer);')],
+  ['versions: sort',            loop('r = bench.Version.sort(v.keys);')],
+  ['versions: filter',          loop('r = bench.Version.filter(v.keys, v.range);')]
+];
+
+function valueFor(name) {
+  if (/^read short/.test(name)) return values.short;
+  if (/^read long/.test(name)) return values.long;
+  if (/^read array/.test(name)) return values.array;
+  if (/^read typed/.test(name)) return values.typed;
+  if (/^range/.test(name)) return values.range;
+  if (/^versions/.test(name)) return values.versions;
+  return values.version;
+}
+
+function measure(fn, value) {
+  // Calibrate the number of iterations
+  var n = 1000, elapsed;
+  for (;;) {
+    elapsed = time(fn, value, n);
+    if (elapsed > options.time / 10) break;
+    n *= 4;
+  }
+  n = Math.max(1, Math.round(n * options.time / elapsed));
+
+  var best = Infinity;
+  for (var run = 0; run < options.runs; run++) {
+    gc();
+    best = Math.min(best, time(fn, value, n) * 1e6 / n);
+  }
+
+  // Small enough not to trigger a scavenge in the middle
+  var m = 1000;
+  gc();
+  var allocs = bench.allocations();
+  var heap = process.memoryUsage().heapUsed;
+  fn(bench, value, m);
+  heap = process.memoryUsage().heapUsed - heap;
+  allocs = bench.allocations() - allocs;
+
+  return {ns: best, allocs: allocs / m, heap: Math.max(0, heap / m)};
+}
+
+function time(fn, value, n) {
+  var start = process.hrtime();
+  fn(bench, value, n);
+  var diff = process.hrtime(start);
+  return diff[0] * 1e3 + diff[1] / 1e6;
+}
+
+function pad(str, length, left) {
+  str = String(str);
+  while (str.length < length) str = left ? ' ' + str : str + ' ';
+  return str;
+}
+
+var results = {};
+console.log(pad('case', 28) + pad('ns/op', 10, true) + pad('allocs/op', 11, true) +
+            pad('heap B/op', 11, true));
+cases.forEach(function (c) {
+  var name = c[0];
+  if (options.filter && !options.filter.test(name)) return;
+  if (c[2] && !bench[c[2]]) {
+    // C++11-only cases, or Node versions without the API
+    console.log(pad(name, 28) + '  skipped, the addon has no ' + c[2] + '()');
+    return;
+  }
+  var result = results[name] = measure(c[1], valueFor(name));
+  console.log(pad(name, 28) + pad(result.ns.toFixed(1), 10, true) +
+              pad(result.allocs.toFixed(2), 11, true) +
+              pad(result.heap.toFixed(0), 11, true));
+});
+
+if (options.save) {
+  fs.writeFileSync(options.save, JSON.stringify({
+    node: process.version,
+    results: results
+  }, null, 2) + '\n');
+}
+
+if (options.check) {
+  var baseline = JSON.parse(fs.readFileSync(options.check, 'utf8'));
+  if (baseline.node !== process.version)
+    console.warn('\nBaseline was taken with node ' + baseline.node);
+  var failed = [];
+  Object.keys(baseline.results).forEach(function (name) {
+    if (!results[name] && (!options.filter || options.filter.test(name)))
+      failed.push(name + ': missing from this run');
+  });
+  Object.keys(results).forEach(function (name) {
+    var before = baseline.results[name], after = results[name];
+    if (!before) return;
+    if (after.ns > before.ns * (1 + options.tolerance))
+      failed.push(name + ': ' + before.ns.toFixed(1) + ' -> ' + after.ns.toFixed(1) + ' ns/op');
+    if (after.allocs > before.allocs + 0.01)
+      failed.push(name + ': ' + before.allocs.toFixed(2) + ' -> ' + after.allocs.toFixed(2) + ' allocs/op');
+  });
+  if (failed.length) {
+    console.error('\nRegressions:\n  ' + failed.join('\n  '));
+    process.exit(1);
+  }
+  console.log('\nNo regressions against ' + options.check);
+}
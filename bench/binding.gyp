@@ -0,0 +1,44 @@
+{
+  "targets": [
+    {
+      "target_name": "bench",
+      "sources": ["bench.cc"],
+      "include_dirs": [".."],
+      "cflags_cc": ["-std=c++11"],
+      "cflags!": ["-fno-exceptions"],
+      "cflags_cc!": ["-fno-exceptions"],
+      "xcode_settings": {
+        "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11"]
+      },
+      "conditions": [
+        ["OS=='linux'", {"ldflags": ["-Wl,-Bsymbolic"]}]
+      ]
+    },
+    {
+      "target_name": "startup_eager",
+      "sources": ["startup.cc"],
+      "include_dirs": [".."],
+      "cflags_cc": ["-std=c++11"],
+      "cflags!": ["-fno-exceptions"],
+      "cflags_cc!": ["-fno-exceptions"],
+      "xcode_settings": {
+        "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11"]
+      }
+    },
+    {
+      "target_name": "startup_lazy",
+      "sources": ["startup.cc"],
+      "include_dirs": [".."],
+      "cflags_cc": ["-std=c++11"],
+      "cflags!": ["-fno-exceptions"],
+      "cflags_cc!": ["-fno-exceptions"],
+      "xcode_settings": {
+        "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11"]
+      },
+      "defines": ["V8U_STARTUP_LAZY"]
+    }
+  ]
+}
@@ -0,0 +1,34 @@
+// Heap bytes taken by each wrapped instance.
+// Usage: node --expose-gc memory.js [count]
+
+var bench = require('./build/Release/bench');
+
+if (typeof gc !== 'function') {
+  console.error('Run with --expose-gc');
+  process.exit(1);
+}
+
+var count = +process.argv[2] || 100000;
+
+function perInstance(create) {
+  var keep = new Array(count);
+  gc(); gc();
+  var before = process.memoryUsage().heapUsed;
+  for (var i = 0; i < count; i++) keep[i] = create(i);
+  gc(); gc();
+  var after = process.memoryUsage().heapUsed;
+  // Touch them so nothing is collected early
+  if (keep[count - 1].toString === undefined) throw new Error('unreachable');
+  return (after - before) / count;
+}
+
+var cases = {
+  'methods on instances': function () { return new bench.OwnMethods(); },
+  'methods on prototype': function () { return new bench.ProtoMethods(); },
+  'Version': function (i) { return new bench.Version(i & 0xFFFF, 2, 3); }
+};
+
+Object.keys(cases).forEach(function (name) {
+  var bytes = perInstance(cases[name]);
+  console.log(name + ': ' + bytes.toFixed(1) + ' bytes/instance');
+});
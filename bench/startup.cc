@@ -0,0 +1,58 @@
+/*
+ * Startup benchmark addon: 80 types with a few methods and accessors each,
+ * registered eagerly (startup_eager) or with NODE_DEF_LAZY (startup_lazy).
+ * See startup.js.
+ */
+
+#include "v8u.hpp"
+
+using namespace v8u;
+
+#define STARTUP_TYPE(N)                                                        \
+class Type##N : public node::ObjectWrap {                                      \
+public:                                                                        \
+  V8_CTOR() {                                                                  \
+    V8_WRAP(new Type##N);                                                      \
+  } V8_CTOR_END()                                                              \
+                                                                               \
+  static V8_CB(Method) {                                                       \
+  } V8_CB_END()                                                                \
+  static V8_GET(Get) {                                                         \
+    V8_RET(Int(N));                                                            \
+  } V8_GET_END()                                                               \
+                                                                               \
+  NODE_TYPE(Type##N, "Type" #N) {                                              \
+    V8_DEF_GET("id", Get);                                                     \
+    V8_DEF_GET("size", Get);                                                   \
+    V8_DEF_CB("open", Method);                                                 \
+    V8_DEF_CB("close", Method);                                                \
+    V8_DEF_CB("read", Method);                                                 \
+    V8_DEF_CB("write", Method);                                                \
+    V8_DEF_CB("toString", Method);                                             \
+  } NODE_TYPE_END()                                                            \
+};                                                                             \
+V8_POST_TYPE(Type##N)
+
+//// X(10) ... X(89)
+#define STARTUP_TENS(X, D)                                                     \
+  X(D##0) X(D##1) X(D##2) X(D##3) X(D##4)                                      \
+  X(D##5) X(D##6) X(D##7) X(D##8) X(D##9)
+#define STARTUP_TYPES(X)                                                       \
+  STARTUP_TENS(X, 1) STARTUP_TENS(X, 2) STARTUP_TENS(X, 3)                     \
+  STARTUP_TENS(X, 4) STARTUP_TENS(X, 5) STARTUP_TENS(X, 6)                     \
+  STARTUP_TENS(X, 7) STARTUP_TENS(X, 8)
+
+STARTUP_TYPES(STARTUP_TYPE)
+
+#define STARTUP_EAGER(N) Type##N::init(target);
+#define STARTUP_LAZY(N) NODE_DEF_LAZY("Type" #N, Type##N::init);
+
+#ifdef V8U_STARTUP_LAZY
+NODE_DEF_MAIN() {
+  STARTUP_TYPES(STARTUP_LAZY)
+} NODE_DEF_MAIN_END(startup_lazy)
+#else
+NODE_DEF_MAIN() {
+  STARTUP_TYPES(STARTUP_EAGER)
+} NODE_DEF_MAIN_END(startup_eager)
+#endif
@@ -0,0 +1,56 @@
+// Startup time of an addon with 80 types: every init() at require() time
+// (startup_eager) against NODE_DEF_LAZY (startup_lazy). Each sample is a
+// fresh process, so nothing is cached between them.
+//
+// Usage: node startup.js [samples]   (default 20)
+
+var execFile = require('child_process').execFile;
+var path = require('path');
+
+var samples = +process.argv[2] || 20;
+var variants = ['startup_eager', 'startup_lazy'];
+var results = {eager: [], lazy: []};
+
+// Runs in the child: times require() and then the first use of one type
+function child(file) {
+  function ms(start) {
+    var diff = process.hrtime(start);
+    return diff[0] * 1e3 + diff[1] / 1e6;
+  }
+  var start = process.hrtime();
+  var addon = require(file);
+  var load = ms(start);
+  start = process.hrtime();
+  new addon.Type42().open();
+  var first = ms(start);
+  console.log(JSON.stringify({load: load, first: first}));
+}
+
+function run(i) {
+  if (i === samples * variants.length) return report();
+  var name = variants[i % variants.length];
+  var file = path.join(__dirname, 'build', 'Release', name + '.node');
+  var code = '(' + child + ')(' + JSON.stringify(file) + ')';
+  execFile(process.execPath, ['-e', code], function (err, stdout) {
+    if (err) throw err;
+    results[name.slice(8)].push(JSON.parse(stdout));
+    run(i + 1);
+  });
+}
+
+function median(list, key) {
+  var values = list.map(function (r) { return r[key]; }).sort(function (a, b) { return a - b; });
+  return values[values.length >> 1];
+}
+
+function report() {
+  console.log('           require()   first use   (median ms of ' + samples + ')');
+  Object.keys(results).forEach(function (key) {
+    var list = results[key];
+    console.log((key + '          ').slice(0, 10) +
+                ('         ' + median(list, 'load').toFixed(3)).slice(-10) +
+                ('            ' + median(list, 'first').toFixed(3)).slice(-12));
+  });
+}
+
+run(0);
@@ -0,0 +1,16 @@
+{
+  "targets": [
+    {
+      "target_name": "test",
+      "sources": ["test.cc"],
+      "include_dirs": [".."],
+      "cflags_cc": ["-std=c++11"],
+      "cflags!": ["-fno-exceptions"],
+      "cflags_cc!": ["-fno-exceptions"],
+      "xcode_settings": {
+        "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11"]
+      }
+    }
+  ]
+}
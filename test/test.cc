@@ -0,0 +1,505 @@
+/*
+ * Test addon for V8U. Build it with `node-gyp rebuild` from this
+ * directory, then run `node test.js`. Every exported function returns
+ * true if its check passed.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <type_traits>
+
+#include "v8u.hpp"
+#include "version.hpp"
+
+using namespace v8u;
+
+// Persisted
+
+static_assert(std::is_nothrow_move_constructible<Persisted<v8::Object> >::value,
+              "vectors of Persisted must move on reallocation");
+
+//// Growing a vector moves the global handles instead of creating new ones
+V8_CB(PersistedVectorGrowth) {
+  std::vector<Persisted<v8::Object> > items;
+  std::vector<v8::Object*> cells;
+  for (int i = 0; i < 1000; i++) {
+    items.push_back(Persisted<v8::Object>(Obj()));
+    cells.push_back(items.back().operator->());
+  }
+  bool same = true;
+  for (size_t i = 0; i < items.size(); i++)
+    same = same && items[i].operator->() == cells[i];
+  V8_RET(Bool(same));
+} V8_CB_END()
+
+// UTF-8 decoding (ExternalStr)
+
+//// Returns the index of the first case decoded wrong, or true
+V8_CB(Utf8Decoding) {
+  struct Case {
+    const char* input;
+    std::vector<uint16_t> expected;
+  };
+  const Case cases [] = {
+    {"a\xC3\xA9", {0x61, 0xE9}},
+    {"\xE2\x82\xAC", {0x20AC}},
+    {"\xF0\x9F\x98\x80", {0xD83D, 0xDE00}},
+    {"\xF4\x8F\xBF\xBF", {0xDBFF, 0xDFFF}},
+    {"\xED\x9F\xBF", {0xD7FF}},
+    // Overlong forms
+    {"\xC0\xAF", {0xFFFD, 0xFFFD}},
+    {"\xE0\x80\xAF", {0xFFFD, 0xFFFD, 0xFFFD}},
+    {"\xF0\x80\x80\xAF", {0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD}},
+    // Surrogates
+    {"\xED\xA0\x80", {0xFFFD, 0xFFFD, 0xFFFD}},
+    // Past U+10FFFF
+    {"\xF4\x90\x80\x80", {0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD}},
+    // Truncated
+    {"\xE2\x82", {0xFFFD}},
+    {"\xE2\x82" "a", {0xFFFD, 0x61}},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    std::vector<uint16_t> decoded;
+    internal::DecodeUtf8(cases[i].input, strlen(cases[i].input), decoded);
+    if (decoded != cases[i].expected) V8_RET(Int(i));
+  }
+  V8_RET(Bool(true));
+} V8_CB_END()
+
+// V8_FAIL and V8_CHECK
+
+//// Bumped only by calls that got past their checks
+static int32_t passed = 0;
+static double limit = 1;
+
+//// clamp(value, max)
+V8_CB(Clamp) {
+  V8_CHECK(CheckArguments(2, info));
+  if (!info[0]->IsNumber() || !info[1]->IsNumber())
+    V8_FAIL(TypeErr("Arguments must be numbers."));
+  passed++;
+  V8_RET(Num(std::min(Num(info[0]), Num(info[1]))));
+} V8_CB_END()
+
+V8_CB(Passed) {
+  V8_RET(Int(passed));
+} V8_CB_END()
+
+V8_GET(GetLimit) {
+  V8_RET(Num(limit));
+} V8_GET_END()
+
+V8_SET(SetLimit) {
+  if (!value->IsNumber() || Num(value) <= 0)
+    V8_FAIL(RangeErr("limit must be a positive number."));
+  passed++;
+  limit = Num(value);
+} V8_SET_END()
+
+// Utf8
+
+//// [byte length, the string decoded back]
+V8_CB(Utf8Echo) {
+  Utf8 str (info[0]);
+  v8::Local<v8::Array> ret = Arr();
+  ret->Set(0, Uint(str.length()));
+  ret->Set(1, Str(str.data(), str.length()));
+  V8_RET(ret);
+} V8_CB_END()
+
+//// utf8Spare(a, b), both spilling: [b, a again, whether b got a's freed
+//// buffer, whether the second a got its own while b held the spare]
+V8_CB(Utf8Spare) {
+  const char* first;
+  {
+    Utf8 a (info[0]);
+    first = *a;
+  }
+  Utf8 b (info[1]);
+  Utf8 a (info[0]);
+  v8::Local<v8::Array> ret = Arr();
+  ret->Set(0, Str(b.data(), b.length()));
+  ret->Set(1, Str(a.data(), a.length()));
+  ret->Set(2, Bool(*b == first));
+  ret->Set(3, Bool(*a != *b));
+  V8_RET(ret);
+} V8_CB_END()
+
+// Structs
+
+struct Point { int32_t x, y; };
+struct Segment { Point from, to; };
+
+V8U_STRUCT(Point, x, y)
+V8U_STRUCT(Segment, from, to)
+
+static int32_t SegmentWidth(Segment segment) {
+  return segment.to.x - segment.from.x;
+}
+
+// ToVector
+
+//// How many elements ToVector<T> read, or false if it refused the value
+template <class T> V8_CB(VectorLength) {
+  std::vector<T> items (3);
+  if (ToVector(info[0], items)) V8_RET(Uint(items.size()));
+  if (items.size() != 3) V8_THROW(Err("ToVector changed its output."));
+  V8_RET(Bool(false));
+} V8_CB_END()
+
+V8_CB(PointsX) {
+  std::vector<Point> points;
+  if (!ToVector(info[0], points)) V8_RET(Bool(false));
+  std::vector<int32_t> xs;
+  for (size_t i = 0; i < points.size(); i++) xs.push_back(points[i].x);
+  V8_RET(FromVector(xs));
+} V8_CB_END()
+
+// Bytes and View (zero-copy)
+
+//// Flips every bit of a Buffer or typed array in place
+V8_CB(Invert) {
+  Bytes bytes (info[0]);
+  if (bytes.IsEmpty())
+    V8_FAIL(TypeErr("Argument 0 must be a Buffer or typed array."));
+  char* end = bytes.data() + bytes.length();
+  for (char* p = bytes.data(); p != end; p++) *p = ~*p;
+  V8_RET(Uint(bytes.length()));
+} V8_CB_END()
+
+//// Multiplies a Float64Array in place, false for anything else
+V8_CB(Scale) {
+  View<double> view (info[0]);
+  if (view.IsEmpty()) V8_RET(Bool(false));
+  for (double* p = view.begin(); p != view.end(); p++) *p *= Num(info[1]);
+  V8_RET(Bool(true));
+} V8_CB_END()
+
+//// A Buffer over a vector of 0, 1, 4... that it takes ownership of
+V8_CB(Squares) {
+  std::vector<int32_t>* squares = new std::vector<int32_t>;
+  for (int32_t i = 0; i < Int(info[0]); i++) squares->push_back(i * i);
+  V8_RET(Bytes::New(squares));
+} V8_CB_END()
+
+// 64-bit integers
+
+static int64_t Twice(int64_t n) {
+  return n * 2;
+}
+
+// NODE_DEF_TYPE without V8_TYPE (the README example)
+
+class Hello : public node::ObjectWrap {
+public:
+  V8_CTOR() {
+    V8_WRAP(new Hello);
+  } V8_CTOR_END()
+
+  //// Returns its argument, if V8_WRAP did wrap this
+  static V8_CB(World) {
+    if (!node::ObjectWrap::Unwrap<Hello>(info.This()))
+      V8_THROW(TypeErr("Not wrapped."));
+    V8_RET(info[0]);
+  } V8_CB_END()
+
+  NODE_DEF_TYPE("Hello") {
+    V8_DEF_CB("world", World);
+  } NODE_DEF_TYPE_END()
+};
+
+// WrapCache
+
+//// Owned by C++, handed to JS through a WrapCache
+class Item : public node::ObjectWrap {
+public:
+  explicit Item(int id) : id_(id) {}
+
+  V8_CTOR() {
+    V8_WRAP(new Item(0));
+  } V8_CTOR_END()
+
+  static V8_CB(Id) {
+    V8_M_SELF(Item);
+    V8_RET(Int(inst->id_));
+  } V8_CB_END()
+
+  NODE_TYPE(Item, "Item") {
+    V8_DEF_CB("id", Id);
+  } NODE_TYPE_END()
+private:
+  int id_;
+};
+V8_POST_TYPE(Item)
+
+static Item* items [] = {new Item(1), new Item(2)};
+
+static WrapCache<Item>& ItemCache() {
+  static WrapCache<Item>* cache = new WrapCache<Item>;
+  return *cache;
+}
+
+//// The object for items[index], the same one while JS holds on to it
+V8_CB(CachedItem) {
+  V8_RET(ItemCache().Get(items[Int(info[0]) & 1], Item::templ_));
+} V8_CB_END()
+
+V8_CB(RemoveItem) {
+  ItemCache().Remove(items[Int(info[0]) & 1]);
+} V8_CB_END()
+
+// V8_INHERIT and type tags
+
+class Shape : public node::ObjectWrap {
+public:
+  explicit Shape(int32_t sides) : sides_(sides) {}
+  inline int32_t sides() const {
+    return sides_;
+  }
+
+  V8_CTOR() {
+    V8_WRAP(new Shape(0));
+  } V8_CTOR_END()
+
+  static V8_CB(Sides) {
+    V8_M_SELF(Shape);
+    V8_RET(Int(inst->sides_));
+  } V8_CB_END()
+
+  NODE_TYPE(Shape, "Shape") {
+    V8_DEF_CB("sides", Sides);
+  } NODE_TYPE_END()
+private:
+  int32_t sides_;
+};
+V8_POST_TYPE(Shape)
+
+class Square : public Shape {
+public:
+  Square() : Shape(4) {}
+
+  V8_CTOR() {
+    V8_WRAP(new Square);
+  } V8_CTOR_END()
+
+  NODE_TYPE(Square, "Square") {
+    V8_INHERIT(Shape);
+  } NODE_TYPE_END()
+};
+V8_POST_TYPE(Square)
+
+//// shapeSides(object), through Shape::Unwrap instead of a method
+V8_CB(ShapeSides) {
+  if (!info[0]->IsObject()) V8_FAIL(TypeErr("Argument 0 must be an object."));
+  Shape* shape = Shape::Unwrap(Obj(info[0]));
+  V8_CHECK(shape);
+  V8_RET(Int(shape->sides()));
+} V8_CB_END()
+
+// Pool
+
+class Pooled : public node::ObjectWrap {
+public:
+  V8_CTOR() {
+    V8_WRAP(new Pooled);
+  } V8_CTOR_END()
+
+  NODE_TYPE_POOLED(Pooled, "Pooled") {
+  } NODE_TYPE_END()
+};
+V8_POST_TYPE(Pooled)
+
+V8_CB(PooledLive) {
+  V8_RET(Int(Pool<Pooled>::Live()));
+} V8_CB_END()
+
+// Promises
+
+#ifdef __v8_promises
+//// Resolves with its argument, unless it's false, a string or missing
+V8_PROMISE_CB(Settle) {
+  V8_CHECK(CheckArguments(1, info));
+  if (info[0]->IsFalse()) V8_FAIL(RangeErr("Failed."));
+  if (info[0]->IsString()) throw std::runtime_error(*Utf8(info[0]));
+  deferred.Resolve(info[0]);
+} V8_PROMISE_CB_END()
+#endif
+
+// Asynchronous callbacks
+
+struct SumBaton {
+  int32_t count;
+  double sum;
+  std::thread::id caller, worker;
+};
+
+//// sumTo(count, callback): adds 0...count on the threadpool
+V8_ASYNC_CB(SumTo, SumBaton) {
+  if (!info[0]->IsInt32()) V8_THROW(TypeErr("Argument 0 must be an integer."));
+  baton->count = Int(info[0]);
+  baton->caller = std::this_thread::get_id();
+} V8_ASYNC_EXECUTE() {
+  baton->worker = std::this_thread::get_id();
+  if (baton->count < 0) throw std::range_error("Negative count.");
+  baton->sum = 0;
+  for (int32_t i = 0; i <= baton->count; i++) baton->sum += i;
+} V8_ASYNC_COMPLETE() {
+  if (baton->worker == baton->caller)
+    throw std::runtime_error("Executed on the JS thread.");
+  return Num(baton->sum);
+} V8_ASYNC_END()
+
+// Channel
+
+//// Counts live copies, so the test can tell every item was freed once
+struct Counted {
+  explicit Counted(int32_t id) : id(id) { live++; }
+  Counted(const Counted& other) : id(other.id) { live++; }
+  ~Counted() { live--; }
+  int32_t id;
+  static std::atomic<int> live;
+};
+std::atomic<int> Counted::live (0);
+
+static v8::Handle<v8::Value> CountedId(const Counted& item) {
+  return Int(item.id);
+}
+
+static Channel<Counted>* channel = NULL;
+static std::thread producer;
+static std::atomic<int32_t> pushed (0);
+
+//// Starts a thread pushing 0, 1, 2... into a small channel until it's closed
+V8_CB(ChannelStart) {
+  channel = new Channel<Counted>(Func(info[0]), 16, CountedId);
+  pushed = 0;
+  producer = std::thread([] {
+    for (int32_t i = 0; channel->PushWait(Counted(i)); i++) pushed++;
+  });
+} V8_CB_END()
+
+//// Closes it while the thread is still producing, returns how many it pushed
+V8_CB(ChannelClose) {
+  channel->Close();
+  producer.join();
+  channel = NULL;
+  V8_RET(Int(pushed.load()));
+} V8_CB_END()
+
+V8_CB(ChannelLive) {
+  V8_RET(Int(Counted::live.load()));
+} V8_CB_END()
+
+// Cursor
+
+//// Counts the sources still held by a cursor
+static std::atomic<int> sources (0);
+
+//// Yields 0, 1... up to count, throws when it reaches fail
+struct Source {
+  Source(int32_t count, int32_t fail) : next(0), count(count), fail(fail) {
+    sources++;
+  }
+  ~Source() { sources--; }
+  int32_t next, count, fail;
+};
+
+//// countTo(count, batch, [fail])
+V8_CB(CountTo) {
+  std::shared_ptr<Source> source = std::make_shared<Source>(Int(info[0]),
+      info[2]->IsInt32() ? Int(info[2]) : -1);
+  V8_RET(Cursor::Generate<int32_t>([source](int32_t& item) {
+    if (source->next == source->fail)
+      throw std::runtime_error("Generator failed.");
+    if (source->next == source->count) return false;
+    item = source->next++;
+    return true;
+  }, Uint(info[1])));
+} V8_CB_END()
+
+V8_CB(CursorSources) {
+  V8_RET(Int(sources.load()));
+} V8_CB_END()
+
+// NODE_DEF_LAZY
+
+class Sleepy : public node::ObjectWrap {
+public:
+  V8_CTOR() {
+    V8_WRAP(new Sleepy);
+  } V8_CTOR_END()
+
+  static V8_CB(Ping) {
+    V8_M_SELF(Sleepy);
+    V8_RET(Str("pong"));
+  } V8_CB_END()
+
+  NODE_TYPE(Sleepy, "Sleepy") {
+    V8_DEF_CB("ping", Ping);
+  } NODE_TYPE_END()
+};
+V8_POST_TYPE(Sleepy)
+
+static int sleepyInits = 0;
+
+//// Counts how many times NODE_DEF_LAZY ran it
+void InitSleepy(v8::Handle<v8::Object> target) {
+  sleepyInits++;
+  Sleepy::init(target);
+}
+
+V8_CB(SleepyInits) {
+  V8_RET(Int(sleepyInits));
+} V8_CB_END()
+
+#define TEST_DEF(NAME, FUNCTION)                                               \
+  target->Set(V8U_SYMBOL(NAME), Func(FUNCTION))
+
+NODE_DEF_MAIN() {
+  TEST_DEF("persistedVectorGrowth", PersistedVectorGrowth);
+  TEST_DEF("utf8Decoding", Utf8Decoding);
+  TEST_DEF("utf8Echo", Utf8Echo);
+  TEST_DEF("utf8Spare", Utf8Spare);
+  TEST_DEF("clamp", Clamp);
+  TEST_DEF("passed", Passed);
+  target->SetAccessor(V8U_SYMBOL("limit"), GetLimit, SetLimit);
+  TEST_DEF("segmentWidth", V8_BIND(SegmentWidth));
+  TEST_DEF("invert", Invert);
+  TEST_DEF("scale", Scale);
+  TEST_DEF("squares", Squares);
+  TEST_DEF("twice", V8_BIND(Twice));
+  TEST_DEF("fastTwice", V8_FAST_BIND(Twice));
+  TEST_DEF("pointsX", PointsX);
+  TEST_DEF("pointLength", VectorLength<Point>);
+  TEST_DEF("int32Length", VectorLength<int32_t>);
+  TEST_DEF("objectLength", VectorLength<v8::Local<v8::Object> >);
+  TEST_DEF("arrayLength", VectorLength<v8::Local<v8::Array> >);
+  TEST_DEF("functionLength", VectorLength<v8::Local<v8::Function> >);
+  Hello::init(target);
+  Item::init(target);
+  TEST_DEF("sumTo", SumTo);
+  TEST_DEF("channelStart", ChannelStart);
+  TEST_DEF("channelClose", ChannelClose);
+  TEST_DEF("channelLive", ChannelLive);
+  TEST_DEF("countTo", CountTo);
+  TEST_DEF("cursorSources", CursorSources);
+  TEST_DEF("sleepyInits", SleepyInits);
+  NODE_DEF_LAZY("Sleepy", InitSleepy);
+  Version::init(target);
+  VersionRange::init(target);
+#ifdef __v8_promises
+  TEST_DEF("settle", Settle);
+#endif
+  TEST_DEF("cachedItem", CachedItem);
+  Shape::init(target);
+  Square::init(target);
+  TEST_DEF("shapeSides", ShapeSides);
+  Pooled::init(target);
+  TEST_DEF("pooledLive", PooledLive);
+  TEST_DEF("removeItem", RemoveItem);
+} NODE_DEF_MAIN_END(test)
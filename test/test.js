@@ -0,0 +1,395 @@
+// Runs the checks exported by the test addon. Tests that take an argument
+// are asynchronous, and call it (with an error, if they failed) when done.
+//
+// Usage: node --expose-gc test.js [filter]
+
+var assert = require('assert');
+var addon = require('./build/Release/test');
+
+var filter = process.argv[2] ? new RegExp(process.argv[2]) : null;
+var failed = 0;
+
+var tests = {
+  'Persisted: growing a vector creates no handles': function () {
+    assert.ok(addon.persistedVectorGrowth());
+  },
+  'DecodeUtf8: rejects overlongs, surrogates and values past U+10FFFF': function () {
+    assert.strictEqual(addon.utf8Decoding(), true, 'wrong output for case');
+  },
+  'Utf8: long and multibyte strings, spare buffer reuse': function () {
+    function repeat(str, count) {
+      return new Array(count + 1).join(str);
+    }
+    // Around V8U_INLINE_STR (256) bytes, and well past it
+    [
+      repeat('a', 255), repeat('a', 256), repeat('a', 257), repeat('a', 5000),
+      repeat('\u00e9', 100), repeat('\u00e9', 200), repeat('\u20ac', 86),
+      repeat('\ud83d\ude00', 64), 'a' + repeat('\u20ac', 1000) + 'z', ''
+    ].forEach(function (str) {
+      var echo = addon.utf8Echo(str);
+      assert.strictEqual(echo[0], Buffer.byteLength(str));
+      assert.ok(echo[1] === str, 'wrong round trip for ' + str.length + ' units');
+    });
+    assert.deepEqual(addon.utf8Echo(12), [2, '12']);
+
+    // 256 bytes is the smallest string that spills, so whatever spare earlier
+    // calls left is big enough for these
+    var a = repeat('x', 256), b = repeat('\u20ac', 85) + 'x';
+    var spare = addon.utf8Spare(a, b);
+    assert.ok(spare[0] === b && spare[1] === a, 'strings changed');
+    assert.strictEqual(spare[2], true, 'b did not reuse the spare buffer');
+    assert.strictEqual(spare[3], true, 'a and b share a buffer');
+    spare = addon.utf8Spare(b, a);
+    assert.ok(spare[0] === a && spare[1] === b, 'strings changed');
+    assert.strictEqual(spare[2], true, 'a did not reuse the spare buffer');
+    assert.strictEqual(spare[3], true, 'a and b share a buffer');
+  },
+  'V8_FAIL, V8_CHECK: throw the scheduled error and return right away': function () {
+    var passed = addon.passed();
+    assert.strictEqual(addon.clamp(5, 3), 3);
+    assert.throws(function () { addon.clamp(5); }, function (err) {
+      return err instanceof RangeError && err.message === 'Not enough arguments.';
+    });
+    assert.throws(function () { addon.clamp(5, '3'); }, function (err) {
+      return err instanceof TypeError && err.message === 'Arguments must be numbers.';
+    });
+    assert.strictEqual(addon.passed(), passed + 1);
+    addon.limit = 2;
+    assert.throws(function () { addon.limit = -1; }, function (err) {
+      return err instanceof RangeError && /positive number/.test(err.message);
+    });
+    assert.strictEqual(addon.limit, 2);
+    assert.strictEqual(addon.passed(), passed + 2);
+    // Nothing stays scheduled after a failed call
+    assert.strictEqual(addon.clamp(1, 3), 1);
+  },
+  'V8U_STRUCT: fields are checked, the bad one is named': function () {
+    var from = {x: 1, y: 2};
+    assert.equal(addon.segmentWidth({from: from, to: {x: 4, y: 0}}), 3);
+    assert.throws(function () {
+      addon.segmentWidth({from: from, to: {x: '4', y: 0}});
+    }, /Argument 0 must be an object whose "to" is an object whose "x" is a number/);
+    assert.throws(function () {
+      addon.segmentWidth({from: from});
+    }, /whose "to" is an object\./);
+  },
+  'ToVector: every element is checked, out is left alone on failure': function () {
+    assert.deepEqual(addon.pointsX([{x: 1, y: 2}, {x: 3, y: 4}]), [1, 3]);
+    assert.strictEqual(addon.pointLength([{x: 1, y: 2}]), 1);
+    [
+      [{x: 1, y: 2}, null],
+      [{x: 1, y: 2}, 5],
+      [{x: '1', y: 2}],
+      [undefined],
+      new Array(2)
+    ].forEach(function (array) {
+      assert.strictEqual(addon.pointsX(array), false);
+      assert.strictEqual(addon.pointLength(array), false);
+    });
+    assert.strictEqual(addon.int32Length([1, 2, 3, 4]), 4);
+    assert.strictEqual(addon.int32Length([1, '2']), false);
+    assert.strictEqual(addon.int32Length('1,2'), false);
+    assert.strictEqual(addon.objectLength([{}, [], function () {}]), 3);
+    assert.strictEqual(addon.objectLength([{}, 1]), false);
+    assert.strictEqual(addon.arrayLength([[], {}]), false);
+    assert.strictEqual(addon.functionLength([function () {}, {}]), false);
+  },
+  'Bytes, View: C++ writes through to the JS memory and back': function () {
+    var buffer = new Buffer([0x00, 0x0F, 0xFF]);
+    assert.strictEqual(addon.invert(buffer), 3);
+    assert.deepEqual(Array.prototype.slice.call(buffer), [0xFF, 0xF0, 0x00]);
+    // A slice shares the parent's memory, so only that part changes
+    addon.invert(buffer.slice(1, 2));
+    assert.deepEqual(Array.prototype.slice.call(buffer), [0xFF, 0x0F, 0x00]);
+    assert.throws(function () { addon.invert([1, 2]); }, TypeError);
+
+    if (typeof Float64Array === 'function') {
+      var floats = new Float64Array([1.5, -2, 3]);
+      assert.strictEqual(addon.scale(floats, 2), true);
+      assert.deepEqual(Array.prototype.slice.call(floats), [3, -4, 6]);
+      assert.strictEqual(addon.scale(new Float32Array([1]), 2), false);
+      assert.strictEqual(addon.invert(new Uint16Array([0x00FF])), 2);
+    }
+    assert.strictEqual(addon.scale([1], 2), false);
+
+    var squares = addon.squares(5);
+    assert.ok(Buffer.isBuffer(squares));
+    assert.strictEqual(squares.length, 20);
+    [0, 1, 4, 9, 16].forEach(function (square, i) {
+      assert.strictEqual(squares.readInt32LE(i * 4), square);
+    });
+    // Changes made from JS show up in what C++ reads back
+    squares.writeInt32LE(-1, 0);
+    addon.invert(squares);
+    assert.strictEqual(squares.readInt32LE(0), 0);
+    assert.strictEqual(squares.readInt32LE(4), ~1);
+  },
+  'int64_t: V8_BIND and V8_FAST_BIND return values past 2^31 whole': function () {
+    [3, -5, 3000000000, -3000000000, Math.pow(2, 40) + 1].forEach(function (n) {
+      assert.strictEqual(addon.twice(n), n * 2);
+      assert.strictEqual(addon.fastTwice(n), n * 2);
+    });
+  },
+  'VersionRange: canonical form and matches': function () {
+    // range, canonical form, versions in it, versions out of it
+    var cases = [
+      ['^0.x', '<1.0.0', ['0.0.0', '0.9.9'], ['1.0.0']],
+      ['^0.2.3', '>=0.2.3 <0.3.0', ['0.2.3', '0.2.9'], ['0.2.2', '0.3.0']],
+      ['^0.0.3', '0.0.3', ['0.0.3'], ['0.0.2', '0.0.4']],
+      ['^1.2', '>=1.2.0 <2.0.0', ['1.2.0', '1.9.0'], ['1.1.9', '2.0.0']],
+      ['~1.2.3', '>=1.2.3 <1.3.0', ['1.2.3', '1.2.10'], ['1.2.2', '1.3.0']],
+      ['~>1.2', '>=1.2.0 <1.3.0', ['1.2.5'], ['1.3.0']],
+      ['~1', '>=1.0.0 <2.0.0', ['1.5.0'], ['2.0.0']],
+      ['1.2 - 2', '>=1.2.0 <3.0.0', ['1.2.0', '2.9.9'], ['1.1.9', '3.0.0']],
+      ['1.2.3 - 2.3.4', '>=1.2.3 <2.3.5', ['2.3.4'], ['1.2.2', '2.3.5']],
+      ['1.x', '>=1.0.0 <2.0.0', ['1.0.0', '1.99.0'], ['0.9.9', '2.0.0']],
+      ['1.2.*', '>=1.2.0 <1.3.0', ['1.2.7'], ['1.3.0']],
+      ['*', '*', ['0.0.0', '99.0.0'], []],
+      ['>=1 <3 || 4.x', '>=1.0.0 <3.0.0 || >=4.0.0 <5.0.0', ['2.0.0', '4.1.0'], ['3.0.0', '5.0.0']],
+      ['1.x || 2.x', '>=1.0.0 <3.0.0', ['2.5.0'], ['3.0.0']],
+      ['>2 <1', '<0.0.0', [], ['0.0.0', '1.5.0', '3.0.0']]
+    ];
+    cases.forEach(function (c) {
+      var range = new addon.VersionRange(c[0]);
+      assert.strictEqual(range.toString(), c[1], c[0]);
+      c[2].forEach(function (v) {
+        assert.strictEqual(range.test(v), true, c[0] + ' should match ' + v);
+      });
+      c[3].forEach(function (v) {
+        assert.strictEqual(range.test(v), false, c[0] + ' should not match ' + v);
+      });
+    });
+    assert.ok(new addon.Version(1, 2, 3).satisfies('^1'));
+  },
+  'VersionRange: prereleases and bad ranges are rejected': function () {
+    ['1.2.3-beta', '>=1.2.3-beta', 'abc', '1 |', '>=', '1.2.3.4', '2097152'].forEach(function (str) {
+      assert.throws(function () { new addon.VersionRange(str); }, /Invalid version range/, str);
+    });
+    assert.throws(function () { new addon.VersionRange(5); }, TypeError);
+
+    var range = new addon.VersionRange('1.2.3');
+    assert.ok(range.test('1.2.3+build.5'));
+    ['1.2.3-beta', '1.2.3+b\u00fc', '1.2'].forEach(function (str) {
+      assert.throws(function () { range.test(str); }, /Invalid version/, str);
+    });
+  },
+  'Version.parseAll: bad entries get INVALID, indices stay aligned': function () {
+    var Version = addon.Version;
+    var keys = Version.parseAll(['1.2.3', 'nope', 5, '2.0.0', null, '1.2.3-beta']);
+    assert.strictEqual(keys.length, 6 * 8);
+    for (var i = 8; i < 16; i++) assert.strictEqual(keys[i], 0xFF);
+    assert.deepEqual(Version.stringify(keys), ['1.2.3', null, null, '2.0.0', null, null]);
+    assert.deepEqual(Version.filter(keys, '>=2'), [3]);
+    assert.deepEqual(Version.stringify(Version.sort(keys)), ['1.2.3', '2.0.0']);
+
+    var lines = 'v1.0.0\nbad\r\n3.2.1+build\n';
+    assert.deepEqual(Version.stringify(Version.parseAll(lines)), ['1.0.0', null, '3.2.1']);
+    assert.deepEqual(Version.stringify(Version.parseAll(new Buffer(lines))), ['1.0.0', null, '3.2.1']);
+    assert.throws(function () { Version.parseAll(5); }, /Array, string or Buffer expected/);
+  },
+  'V8_WRAP: wraps NODE_DEF_TYPE classes without V8_TYPE': function () {
+    var hello = new addon.Hello();
+    assert.strictEqual(hello.world('the cat!'), 'the cat!');
+  },
+  'WrapCache: methods work on cached objects until they are removed': function () {
+    var item = addon.cachedItem(1);
+    assert.strictEqual(addon.cachedItem(1), item);
+    assert.ok(item instanceof addon.Item);
+    assert.strictEqual(item.id(), 2);
+    assert.strictEqual(addon.cachedItem(0).id(), 1);
+    addon.removeItem(1);
+    assert.throws(function () { item.id(); }, /Invalid object unwrapped/);
+    assert.strictEqual(addon.cachedItem(1).id(), 2);
+  },
+  'V8_ASYNC_CB: runs off the JS thread, errors go to the callback': function (done) {
+    assert.throws(function () { addon.sumTo('1', function () {}); },
+                  /Argument 0 must be an integer\./);
+    assert.throws(function () { addon.sumTo(1); }, /Last argument must be a callback/);
+    var returned = false;
+    addon.sumTo(100, function (err, sum) {
+      try {
+        assert.ok(returned, 'the callback ran synchronously');
+        assert.ifError(err);
+        assert.strictEqual(sum, 5050);
+      } catch (e) {
+        return done(e);
+      }
+      addon.sumTo(-1, function (err, sum) {
+        try {
+          assert.ok(err instanceof Error);
+          assert.strictEqual(err.message, 'Negative count.');
+          assert.strictEqual(sum, undefined);
+        } catch (e) {
+          return done(e);
+        }
+        done();
+      });
+    });
+    returned = true;
+  },
+  'Channel: Close() while producing delivers every pushed item once': function (done) {
+    var seen = [];
+    var closing = false;
+    addon.channelStart(function (err, batch) {
+      if (err) return done(err);
+      seen.push.apply(seen, batch);
+      if (closing || seen.length < 1000) return;
+      closing = true;
+      setTimeout(function () {
+        try {
+          // Close() delivers what's left before returning
+          var pushed = addon.channelClose();
+          assert.strictEqual(seen.length, pushed);
+          seen.forEach(function (value, i) {
+            assert.strictEqual(value, i);
+          });
+          assert.strictEqual(addon.channelLive(), 0);
+        } catch (e) {
+          return done(e);
+        }
+        // Nothing left to free once the channel itself is gone either
+        setTimeout(function () {
+          done(addon.channelLive() ? new Error('items leaked') : null);
+        }, 10);
+      }, 0);
+    });
+  },
+  'Cursor: exhaustion releases the source, and stays done': function () {
+    [10, 8].forEach(function (count) {
+      var it = addon.countTo(count, 4);
+      var values = [];
+      for (var step = it.next(); !step.done; step = it.next()) values.push(step.value);
+      assert.deepEqual(values, [0, 1, 2, 3, 4, 5, 6, 7, 8, 9].slice(0, count));
+      assert.strictEqual(addon.cursorSources(), 0);
+      assert.strictEqual(it.next().done, true);
+      assert.strictEqual(it.nextBatch(), null);
+    });
+    var it = addon.countTo(5, 4);
+    assert.deepEqual(it.nextBatch(), [0, 1, 2, 3]);
+    assert.deepEqual(it.nextBatch(100), [4]);
+    assert.strictEqual(it.nextBatch(), null);
+  },
+  'Cursor: return() releases the source early': function () {
+    var it = addon.countTo(100, 4);
+    assert.strictEqual(it.next().value, 0);
+    assert.strictEqual(it.next().value, 1);
+    assert.strictEqual(addon.cursorSources(), 1);
+    assert.deepEqual(it['return'](7), {value: 7, done: true});
+    assert.strictEqual(addon.cursorSources(), 0);
+    assert.strictEqual(it.next().done, true);
+    assert.strictEqual(it.nextBatch(), null);
+  },
+  'Cursor: a generator that throws surfaces the error in JS': function () {
+    var it = addon.countTo(100, 4, 6);
+    assert.deepEqual([it.next().value, it.next().value, it.next().value,
+                      it.next().value], [0, 1, 2, 3]);
+    assert.throws(function () { it.next(); }, /Generator failed\./);
+    assert.throws(function () { it.nextBatch(); }, /Generator failed\./);
+    it['return']();
+    assert.strictEqual(addon.cursorSources(), 0);
+  },
+  'NODE_DEF_LAZY: the first access builds the type, once': function () {
+    assert.strictEqual(addon.sleepyInits(), 0);
+    var Sleepy = addon.Sleepy;
+    assert.strictEqual(addon.sleepyInits(), 1);
+    assert.strictEqual(addon.Sleepy, Sleepy);
+    assert.strictEqual(addon.Sleepy, Sleepy);
+    assert.strictEqual(addon.sleepyInits(), 1);
+    var sleepy = new Sleepy();
+    assert.ok(sleepy instanceof addon.Sleepy);
+    assert.strictEqual(sleepy.ping(), 'pong');
+    assert.ok(!(addon.cachedItem(0) instanceof Sleepy));
+  },
+  'V8_INHERIT: base methods take subclasses, unrelated objects are refused': function () {
+    var square = new addon.Square();
+    assert.ok(square instanceof addon.Shape);
+    assert.strictEqual(square.sides(), 4);
+    assert.strictEqual(addon.Shape.prototype.sides.call(square), 4);
+    assert.strictEqual(addon.shapeSides(square), 4);
+    assert.strictEqual(addon.shapeSides(new addon.Shape()), 0);
+
+    // V8's signature check or the type tag, whichever comes first
+    var item = addon.cachedItem(0);
+    assert.throws(function () { addon.Shape.prototype.sides.call(item); }, TypeError);
+    assert.throws(function () { addon.Shape.prototype.sides.call({}); }, TypeError);
+    // No signature in the way here, so it's the tag that refuses them
+    [item, new addon.Hello(), {}].forEach(function (object) {
+      assert.throws(function () { addon.shapeSides(object); }, function (err) {
+        return err instanceof TypeError && err.message === 'Invalid object unwrapped.';
+      });
+    });
+  },
+  'Pool: Live() goes back to 0 once the objects are collected': function (done) {
+    if (typeof gc !== 'function') return done();  // needs --expose-gc
+    (function () {
+      var objects = [];
+      for (var i = 0; i < 1000; i++) objects.push(new addon.Pooled());
+      assert.strictEqual(addon.pooledLive(), 1000);
+    })();
+    // Weak callbacks may run after gc() returns on newer V8s
+    var tries = 0;
+    (function collect() {
+      gc();
+      if (addon.pooledLive() === 0) return done();
+      if (++tries === 20)
+        return done(new Error(addon.pooledLive() + ' objects still live'));
+      setTimeout(collect, 10);
+    })();
+  },
+  'V8_PROMISE_CB: V8_FAIL, V8_CHECK and throws reject the promise': function (done) {
+    if (!addon.settle) return done();  // Node 0.11.13+ only
+    var promises = [addon.settle(1), addon.settle(false), addon.settle('thrown'), addon.settle()];
+    Promise.all(promises.map(function (promise) {
+      assert.ok(promise instanceof Promise);
+      return promise.then(function (value) {
+        return value;
+      }, function (err) {
+        return err.name + ': ' + err.message;
+      });
+    })).then(function (results) {
+      assert.deepEqual(results, [
+        1,
+        'RangeError: Failed.',
+        'Error: thrown',
+        'RangeError: Not enough arguments.'
+      ]);
+    }).then(done, done);
+  }
+};
+
+var names = Object.keys(tests).filter(function (name) {
+  return !filter || filter.test(name);
+});
+
+(function next(index) {
+  if (index === names.length) process.exit(failed ? 1 : 0);
+  var name = names[index];
+  var finished = false;
+  var timer = setTimeout(function () {
+    done(new Error('timed out'));
+  }, 10000);
+
+  function done(e) {
+    if (finished) return;
+    finished = true;
+    clearTimeout(timer);
+    if (e) {
+      failed++;
+      console.log('FAILED  ' + name + '\n        ' + e.message);
+    } else {
+      console.log('ok      ' + name);
+    }
+    setTimeout(function () { next(index + 1); }, 0);
+  }
+
+  try {
+    if (tests[name].length) {
+      tests[name](done);
+    } else {
+      tests[name]();
+      done();
+    }
+  } catch (e) {
+    done(e);
+  }
+})(0);
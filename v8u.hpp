@@ -29,12 +29,35 @@
 #define	V8U_HPP
 
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 #include <exception>
+#include <cassert>
 #include <map>
+#include <utility>
+#include <algorithm>
+#if __cplusplus >= 201103L
+  #include <type_traits>
+  #include <functional>
+  #include <memory>
+  #include <iterator>
+  #include <atomic>
+  #include <mutex>
+  #include <condition_variable>
+  #include <thread>
+#endif
+#ifdef V8U_STATS
+  #include <chrono>
+#endif
+#if __cplusplus >= 201703L
+  #include <string_view>
+#endif
 
 #include <node.h>
 #include <node_version.h>
 #include <node_object_wrap.h>
+#include <node_buffer.h>
 #include <v8.h>
 
 namespace v8u {
@@ -54,38 +77,303 @@ namespace v8u {
   #define V8_HANDLE_SCOPE(VARIABLE) v8::HandleScope scope (__node_isolate)
   #define V8_RET(VALUE) {info.GetReturnValue().Set(VALUE); return;}
   #define __v8_implicit_return(HANDLE) // implicit return not needed
+  #define __v8_cb_return void
 #else
   #define V8_STHROW_NR(VALUE) v8::ThrowException(VALUE)
   #define V8_STHROW(VALUE) return V8_STHROW_NR(VALUE)
   #define V8_HANDLE_SCOPE(VARIABLE) v8::HandleScope scope
   #define V8_RET(VALUE) return scope.Close(VALUE)
   #define __v8_implicit_return(HANDLE) return HANDLE;
+  #define __v8_cb_return v8::Handle<v8::Value>
+#endif
+
+// Instrumentation (define V8U_STATS to enable it)
+
+#ifdef V8U_STATS
+
+#if __cplusplus < 201103L
+  #error "V8U_STATS needs C++11"
+#endif
+
+//// Time one call out of this many (must be a power of two)
+#ifndef V8U_STATS_SAMPLE
+  #define V8U_STATS_SAMPLE 16
+#endif
+
+#if defined(__GNUC__)
+  #define __v8_function __PRETTY_FUNCTION__
+#elif defined(_MSC_VER)
+  #define __v8_function __FUNCSIG__
+#else
+  #define __v8_function __func__
+#endif
+
+namespace internal {
+
+static_assert((V8U_STATS_SAMPLE & (V8U_STATS_SAMPLE - 1)) == 0,
+              "V8U_STATS_SAMPLE must be a power of two");
+
+/**
+ * Latency histogram: exact below 16ns, then four buckets per power of two
+ * up to 2^40ns. All counters are relaxed atomics, nothing ever locks.
+ **/
+class Histogram {
+public:
+  enum { LINEAR = 16, SPLIT = 4, TOP = 40 };
+  enum { BUCKETS = LINEAR + (TOP - 3) * SPLIT };
+
+  inline Histogram() {
+    for (int i = 0; i < BUCKETS; i++) buckets_[i] = 0;
+  }
+  inline void Add(uint64_t ns) {
+    buckets_[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+  inline uint64_t Count(int bucket) const {
+    return buckets_[bucket].load(std::memory_order_relaxed);
+  }
+
+  static inline int Bucket(uint64_t ns) {
+    if (ns < LINEAR) return ns;
+    int exp = Log2(ns);
+    int bucket = LINEAR + (exp - 4) * SPLIT + ((ns >> (exp - 2)) & (SPLIT - 1));
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+  }
+  static inline uint64_t Lower(int bucket) {
+    if (bucket < LINEAR) return bucket;
+    int exp = (bucket - LINEAR) / SPLIT + 4;
+    return uint64_t(SPLIT + (bucket - LINEAR) % SPLIT) << (exp - 2);
+  }
+private:
+  static inline int Log2(uint64_t value) {
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(value);
+#else
+    int exp = 0;
+    while (value >>= 1) exp++;
+    return exp;
+#endif
+  }
+
+  std::atomic<uint64_t> buckets_ [BUCKETS];
+};
+
+//// Counters for one callback; they register themselves on construction
+class CallStats {
+public:
+  explicit CallStats(const char* name) : name_(name), calls_(0), next_(Head()) {
+    while (!Head().compare_exchange_weak(next_, this)) {}
+  }
+
+  inline uint64_t Enter() {
+    return calls_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static inline std::atomic<CallStats*>& Head() {
+    static std::atomic<CallStats*> head (nullptr);
+    return head;
+  }
+
+  const char* name_;
+  std::atomic<uint64_t> calls_;
+  Histogram latency_;
+  CallStats* next_;
+};
+
+//// Lives for the whole callback, times it when its turn comes
+class CallTimer {
+public:
+  inline explicit CallTimer(CallStats& stats) : stats_(stats), sampled_(
+      (stats.Enter() & (V8U_STATS_SAMPLE - 1)) == 0) {
+    if (sampled_) start_ = std::chrono::steady_clock::now();
+  }
+  inline ~CallTimer() {
+    if (!sampled_) return;
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start_;
+    stats_.latency_.Add(elapsed.count());
+  }
+private:
+  CallStats& stats_;
+  bool sampled_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+enum ErrorKind { PERSISTENT, EXCEPTION, STRING, UNKNOWN, ERROR_KINDS };
+
+inline std::atomic<uint64_t>* Errors() {
+  static std::atomic<uint64_t> errors [ERROR_KINDS] = {};
+  return errors;
+}
+
+inline void CountError(ErrorKind kind) {
+  Errors()[kind].fetch_add(1, std::memory_order_relaxed);
+}
+
+//// "static void v8u::Foo::Bar(const v8::Arguments&)" -> "v8u::Foo::Bar"
+inline std::string CallName(const char* function) {
+  std::string name = function;
+  size_t start = 0, end = name.size();
+  int depth = 0;
+  for (size_t i = 0; i < name.size(); i++) {
+    char c = name[i];
+    if (c == '<') depth++;
+    else if (c == '>') depth--;
+    else if (depth == 0 && c == ' ') start = i + 1;
+    else if (depth == 0 && c == '(') { end = i; break; }
+  }
+  std::string ret = name.substr(start, end - start);
+  size_t with = name.find(" [with ");
+  if (with != std::string::npos) ret += name.substr(with);
+  return ret;
+}
+
+inline v8::Local<v8::Object> StatsObject() {
+  v8::Local<v8::Object> ret = v8::Object::New();
+  v8::Local<v8::Object> callbacks = v8::Object::New();
+  for (CallStats* stats = CallStats::Head().load(); stats; stats = stats->next_) {
+    v8::Local<v8::Object> entry = v8::Object::New();
+    v8::Local<v8::Array> histogram = v8::Array::New();
+    uint64_t sampled = 0;
+    for (int i = 0; i < Histogram::BUCKETS; i++)
+      sampled += stats->latency_.Count(i);
+
+    uint64_t seen = 0;
+    uint64_t p50 = 0, p90 = 0, p99 = 0;
+    for (int i = 0; i < Histogram::BUCKETS; i++) {
+      uint64_t count = stats->latency_.Count(i);
+      if (!count) continue;
+      if (seen < sampled * 0.50 && seen + count >= sampled * 0.50) p50 = Histogram::Lower(i);
+      if (seen < sampled * 0.90 && seen + count >= sampled * 0.90) p90 = Histogram::Lower(i);
+      if (seen < sampled * 0.99 && seen + count >= sampled * 0.99) p99 = Histogram::Lower(i);
+      seen += count;
+      v8::Local<v8::Array> bucket = v8::Array::New(2);
+      bucket->Set(0, v8::Number::New(Histogram::Lower(i)));
+      bucket->Set(1, v8::Number::New(count));
+      histogram->Set(histogram->Length(), bucket);
+    }
+
+    entry->Set(v8::String::NewSymbol("calls"), v8::Number::New(stats->calls_.load()));
+    entry->Set(v8::String::NewSymbol("sampled"), v8::Number::New(sampled));
+    entry->Set(v8::String::NewSymbol("p50"), v8::Number::New(p50));
+    entry->Set(v8::String::NewSymbol("p90"), v8::Number::New(p90));
+    entry->Set(v8::String::NewSymbol("p99"), v8::Number::New(p99));
+    entry->Set(v8::String::NewSymbol("histogram"), histogram);
+    std::string name = CallName(stats->name_);
+    callbacks->Set(v8::String::New(name.data(), name.size()), entry);
+  }
+
+  const char* kinds [] = {"persistent", "exception", "string", "unknown"};
+  v8::Local<v8::Object> errors = v8::Object::New();
+  for (int i = 0; i < ERROR_KINDS; i++)
+    errors->Set(v8::String::NewSymbol(kinds[i]), v8::Number::New(Errors()[i].load()));
+
+  ret->Set(v8::String::NewSymbol("callbacks"), callbacks);
+  ret->Set(v8::String::NewSymbol("errors"), errors);
+  ret->Set(v8::String::NewSymbol("sampleRate"), v8::Number::New(V8U_STATS_SAMPLE));
+  return ret;
+}
+
+};
+
+#define __v8_stats_hook                                                        \
+  static v8u::internal::CallStats __v8_stats (__v8_function);                  \
+  v8u::internal::CallTimer __v8_timer (__v8_stats);
+#define __v8_stats_error(KIND) v8u::internal::CountError(v8u::internal::KIND);
+
+#else
+
+#define __v8_stats_hook
+#define __v8_stats_error(KIND)
+
 #endif
 
 // V8 exception wrapping
 
-#define V8_THROW(VALUE) throw v8::Persistent<v8::Value>::New(VALUE)
+#if !defined(V8U_NO_EXCEPTIONS) && !defined(__EXCEPTIONS) &&                  \
+    !defined(__cpp_exceptions) && !defined(_CPPUNWIND)
+  #define V8U_NO_EXCEPTIONS
+#endif
 
-#define V8_WRAP_START()                                                        \
-  V8_HANDLE_SCOPE(scope);                                                      \
-  try {
+/**
+ * Exception-free error path: V8_FAIL schedules VALUE as the JS exception and
+ * returns from the current V8_CB, V8_GET, V8_SET or V8_CTOR right away, so a
+ * rejected call costs the same as a normal one. V8_CHECK(EXPR) returns the
+ * same way if EXPR is false (the callee has already scheduled an exception).
+ *
+ * Both work with or without C++ exceptions. When building with
+ * -fno-exceptions (or defining V8U_NO_EXCEPTIONS), V8_WRAP_* don't catch
+ * anything, V8_THROW becomes V8_FAIL, and helpers like CheckArguments() or
+ * Unwrap() report errors through their return value:
+ *
+ *   V8_CHECK(v8u::CheckArguments(2, info));
+ *   Version* inst = Unwrap(info.Holder());
+ *   V8_CHECK(inst);
+ **/
+#define V8_FAIL(VALUE) do {V8_STHROW_NR(VALUE); return __v8_return_type();} while (0)
+#define V8_CHECK(EXPR) do {if (!(EXPR)) return __v8_return_type();} while (0)
+
+#ifdef __GNUC__
+  #define __v8_unused __attribute__((unused))
+#else
+  #define __v8_unused
+#endif
+
+#define __v8_returns(TYPE) typedef TYPE __v8_return_type __v8_unused;
+
+#ifdef V8U_NO_EXCEPTIONS
+
+#define V8_THROW(VALUE) V8_FAIL(VALUE)
+#define __v8_raise(VALUE) V8_STHROW_NR(VALUE)
+#define __v8_try {
+#define __v8_catch(HANDLER) }
+
+#else
+
+#define V8_THROW(VALUE) throw v8::Persistent<v8::Value>::New(VALUE)
+#define __v8_raise(VALUE) V8_THROW(VALUE)
+#define __v8_try try {
 
-#define V8_WRAP_END()                                                          \
+//// Maps whatever was thrown into a JS value and passes it to HANDLER(VALUE)
+#define __v8_catch(HANDLER)                                                    \
   } catch (v8::Persistent<v8::Value>& err) {                                   \
-    V8_STHROW_NR(err);                                                         \
+    __v8_stats_error(PERSISTENT)                                               \
+    HANDLER(err);                                                              \
     err.Dispose();                                                             \
   } catch (std::exception& err) {                                              \
-    V8_STHROW_NR(v8::Exception::Error(v8::String::New(err.what())));           \
+    __v8_stats_error(EXCEPTION)                                                \
+    HANDLER(v8::Exception::Error(v8::String::New(err.what())));                \
   } catch (v8::Handle<v8::Value>& err) {                                       \
-    V8_STHROW_NR(err);                                                         \
+    __v8_stats_error(PERSISTENT)                                               \
+    HANDLER(err);                                                              \
   } catch (v8::Value*& err) {                                                  \
-    V8_STHROW_NR(v8::Handle<v8::Value>(err));                                  \
+    __v8_stats_error(PERSISTENT)                                               \
+    HANDLER(v8::Handle<v8::Value>(err));                                       \
   } catch (std::string& err) {                                                 \
-    V8_STHROW_NR(v8::Exception::Error(v8::String::New(err.data(), err.length())));\
+    __v8_stats_error(STRING)                                                   \
+    HANDLER(v8::Exception::Error(v8::String::New(err.data(), err.length())));  \
   } catch (...) {                                                              \
-    V8_STHROW_NR(v8::Exception::Error(v8::String::New("Unknown error!")));     \
+    __v8_stats_error(UNKNOWN)                                                  \
+    HANDLER(v8::Exception::Error(v8::String::New("Unknown error!")));          \
   }
 
+#endif
+
+#define V8_WRAP_START()                                                        \
+  __v8_stats_hook                                                              \
+  V8_HANDLE_SCOPE(scope);                                                      \
+  __v8_try
+
+#define V8_WRAP_END() __v8_catch(V8_STHROW_NR)
+
+//// V8_WRAP_START for callbacks, taking the isolate from info when possible
+#if NODE_VERSION_AT_LEAST(0,11,8)
+  #define __v8_cb_start                                                        \
+    __v8_stats_hook                                                            \
+    v8::HandleScope scope (info.GetIsolate());                                 \
+    __v8_try
+#else
+  #define __v8_cb_start V8_WRAP_START()
+#endif
+
 // JS arguments
 
 #if NODE_VERSION_AT_LEAST(0,11,8)
@@ -94,9 +382,10 @@ namespace v8u {
   #define __v8_arguments_type v8::Arguments
 #endif
 
-inline void CheckArguments(int min, const __v8_arguments_type& info) {
-  if (info.Length() < min)
-    V8_THROW(v8::Exception::RangeError(v8::String::New("Not enough arguments.")));
+inline bool CheckArguments(int min, const __v8_arguments_type& info) {
+  if (info.Length() >= min) return true;
+  __v8_raise(v8::Exception::RangeError(v8::String::New("Not enough arguments.")));
+  return false;
 }
 
 // V8 callback templates
@@ -111,7 +400,8 @@ inline void CheckArguments(int min, const __v8_arguments_type& info) {
 
 #define V8_CB(IDENTIFIER)                                                      \
 V8_SCB(IDENTIFIER) {                                                           \
-  V8_WRAP_START()
+  __v8_returns(__v8_cb_return)                                                 \
+  __v8_cb_start
 
 #define V8_CB_END()                                                            \
   V8_WRAP_END()                                                                \
@@ -132,7 +422,8 @@ V8_SCB(IDENTIFIER) {                                                           \
 
 #define V8_GET(IDENTIFIER)                                                     \
 V8_SGET(IDENTIFIER) {                                                          \
-  V8_WRAP_START()
+  __v8_returns(__v8_cb_return)                                                 \
+  __v8_cb_start
 
 #define V8_GET_END()                                                           \
   V8_WRAP_END()                                                                \
@@ -155,21 +446,398 @@ V8_SGET(IDENTIFIER) {                                                          \
 
 #define V8_SET(IDENTIFIER)                                                     \
 V8_SSET(IDENTIFIER) {                                                          \
-  V8_WRAP_START()
+  __v8_returns(void)                                                           \
+  __v8_cb_start
 
 #define V8_SET_END()                                                           \
   V8_WRAP_END()                                                                \
 }
 
 
+// Per-isolate state (templates, symbols... of each isolate)
+
+#if __cplusplus >= 201103L
+  #define __v8_thread_local thread_local
+#elif defined(_MSC_VER)
+  #define __v8_thread_local __declspec(thread)
+#else
+  #define __v8_thread_local __thread
+#endif
+
+namespace internal {
+
+class Mutex {
+public:
+  inline Mutex() {
+    uv_mutex_init(&mutex_);
+  }
+  inline ~Mutex() {
+    uv_mutex_destroy(&mutex_);
+  }
+  inline void Lock() {
+    uv_mutex_lock(&mutex_);
+  }
+  inline void Unlock() {
+    uv_mutex_unlock(&mutex_);
+  }
+private:
+  uv_mutex_t mutex_;
+};
+
+/**
+ * Everything V8U caches per isolate, found through a thread-local cache
+ * so that the common case (same isolate as last time) takes no lock.
+ * Slots (TypeSlot, SymbolSlot) get an index at construction and keep
+ * their value for each isolate at that index.
+ **/
+class IsolateState {
+public:
+  std::vector<v8::Persistent<v8::FunctionTemplate> > templates;
+  std::vector<v8::Persistent<v8::String> > symbols;
+  std::vector<v8::Persistent<v8::ObjectTemplate> > objects;
+  std::vector<v8::Persistent<v8::External> > tags;
+
+  static inline IsolateState* Current() {
+    return Get(v8::Isolate::GetCurrent());
+  }
+  static IsolateState* Get(v8::Isolate* isolate) {
+    Cache& cache = LocalCache();
+    Globals& globals = Shared();
+    unsigned generation = globals.generation;
+    if (cache.isolate == isolate && cache.generation == generation) return cache.state;
+
+    globals.mutex.Lock();
+    IsolateState*& state = globals.states[isolate];
+    if (!state) state = new IsolateState();
+    cache.isolate = isolate;
+    cache.state = state;
+    cache.generation = globals.generation;
+    globals.mutex.Unlock();
+    return state;
+  }
+  static void Release(v8::Isolate* isolate) {
+    Globals& globals = Shared();
+    globals.mutex.Lock();
+    std::map<v8::Isolate*, IsolateState*>::iterator it = globals.states.find(isolate);
+    if (it != globals.states.end()) {
+      delete it->second;
+      globals.states.erase(it);
+      globals.generation++;
+    }
+    globals.mutex.Unlock();
+  }
+
+  static inline size_t NewTypeIndex() {
+    return NewIndex(Shared().types);
+  }
+  static inline size_t NewSymbolIndex() {
+    return NewIndex(Shared().symbols);
+  }
+  static inline size_t NewObjectIndex() {
+    return NewIndex(Shared().objects);
+  }
+  static inline size_t NewTagIndex() {
+    return NewIndex(Shared().tags);
+  }
+
+  ~IsolateState() {
+    for (size_t i = 0; i < templates.size(); i++)
+      if (!templates[i].IsEmpty()) templates[i].Dispose();
+    for (size_t i = 0; i < symbols.size(); i++)
+      if (!symbols[i].IsEmpty()) symbols[i].Dispose();
+    for (size_t i = 0; i < objects.size(); i++)
+      if (!objects[i].IsEmpty()) objects[i].Dispose();
+    for (size_t i = 0; i < tags.size(); i++)
+      if (!tags[i].IsEmpty()) tags[i].Dispose();
+  }
+private:
+#if __cplusplus >= 201103L
+  typedef std::atomic<unsigned> Generation;
+#else
+  typedef volatile unsigned Generation;
+#endif
+
+  struct Globals {
+    Mutex mutex;
+    std::map<v8::Isolate*, IsolateState*> states;
+    Generation generation;
+    size_t types;
+    size_t symbols;
+    size_t objects;
+    size_t tags;
+  };
+  struct Cache {
+    v8::Isolate* isolate;
+    IsolateState* state;
+    unsigned generation;
+  };
+
+  static inline Globals& Shared() {
+    static Globals globals;
+    return globals;
+  }
+  static inline Cache& LocalCache() {
+    static __v8_thread_local Cache cache = {NULL, NULL, 0};
+    return cache;
+  }
+  static inline size_t NewIndex(size_t& counter) {
+    Globals& globals = Shared();
+    globals.mutex.Lock();
+    size_t index = counter++;
+    globals.mutex.Unlock();
+    return index;
+  }
+};
+
+};
+
+/**
+ * Holds the FunctionTemplate of a V8_TYPE (its templ_), one per isolate.
+ * Behaves like the FunctionTemplate* of the current isolate, which is
+ * NULL until the type is initialized there.
+ **/
+class TypeSlot {
+public:
+  inline TypeSlot() : index_(internal::IsolateState::NewTypeIndex()) {}
+
+  inline v8::FunctionTemplate* Get() const {
+    internal::IsolateState* state = internal::IsolateState::Current();
+    if (index_ >= state->templates.size()) return NULL;
+    return *state->templates[index_];
+  }
+  inline void Set(v8::FunctionTemplate* templ) {
+    internal::IsolateState* state = internal::IsolateState::Current();
+    if (index_ >= state->templates.size()) state->templates.resize(index_ + 1);
+    state->templates[index_] = v8::Persistent<v8::FunctionTemplate>(templ);
+  }
+
+  inline TypeSlot& operator=(v8::FunctionTemplate* templ) {
+    Set(templ);
+    return *this;
+  }
+  inline v8::FunctionTemplate* operator->() const {
+    return Get();
+  }
+  inline operator v8::FunctionTemplate*() const {
+    return Get();
+  }
+  inline bool IsEmpty() const {
+    return !Get();
+  }
+private:
+  TypeSlot(const TypeSlot&);
+  TypeSlot& operator=(const TypeSlot&);
+
+  size_t index_;
+};
+
+/**
+ * Drops what V8U keeps for an isolate (templates, symbols). Call it from
+ * the isolate's thread before disposing an isolate that loaded the addon.
+ **/
+inline void ReleaseIsolate(v8::Isolate* isolate) {
+  internal::IsolateState::Release(isolate);
+}
+
+// Type tags (internal field 1 of V8_DEF_TYPE instances)
+
+#if NODE_VERSION_AT_LEAST(0,11,0)
+  #define __v8_set_pointer(OBJ, I, PTR) (OBJ)->SetAlignedPointerInInternalField(I, PTR)
+  #define __v8_get_pointer(OBJ, I) (OBJ)->GetAlignedPointerFromInternalField(I)
+#else
+  #define __v8_set_pointer(OBJ, I, PTR) (OBJ)->SetPointerInInternalField(I, PTR)
+  #define __v8_get_pointer(OBJ, I) (OBJ)->GetPointerFromInternalField(I)
+#endif
+
+#if NODE_VERSION_AT_LEAST(0,11,8)
+  #define __v8_new_external(PTR) v8::External::New(__node_isolate, PTR)
+#else
+  #define __v8_new_external(PTR) v8::External::New(PTR)
+#endif
+
+namespace internal {
+
+/**
+ * Identifies a wrapped C++ type. Objects are tagged with an External
+ * (one per type and isolate) holding the address of their type's TypeTag.
+ * Tagging looks the External up in the isolate's state; checking only
+ * reads the field back (one Local), and compares the address in it to the
+ * type's, without touching the isolate. V8_INHERIT records subtypes so
+ * that checking for a base type is a short scan. Field 1 of foreign objects may hold anything, so it's only read as
+ * a value, and only Externals are looked into; the addresses in them are
+ * compared, never dereferenced. Anything not tagged (or tagged as an
+ * unrelated type) falls back to FunctionTemplate::HasInstance. Debug
+ * builds also check that tagged objects pass it (see CheckTemplate).
+ *
+ * Subtype lists are copied on write under a lock, and replaced ones are
+ * kept, so Covers() can run on any thread while another one inherits.
+ **/
+class TypeTag {
+public:
+  inline TypeTag() : index_(IsolateState::NewTagIndex()), parent_(NULL),
+                     descendants_(new List()) {}
+  inline bool Covers(const void* tag) const {
+    if (tag == this) return true;
+    const List& descendants = *descendants_;
+    for (size_t i = 0; i < descendants.size(); i++)
+      if (descendants[i] == tag) return true;
+    return false;
+  }
+  void Inherit(TypeTag* parent) {
+    Mutex& mutex = Lock();
+    mutex.Lock();
+    if (!parent_ && parent != this) {
+      parent_ = parent;
+      for (TypeTag* tag = parent; tag; tag = tag->parent_) {
+        const List& own = *descendants_;
+        List* descendants = new List(*tag->descendants_);
+        descendants->push_back(this);
+        descendants->insert(descendants->end(), own.begin(), own.end());
+        tag->descendants_ = descendants;
+      }
+    }
+    mutex.Unlock();
+  }
+  //// The External objects of this type are tagged with, in this isolate
+  v8::Local<v8::External> Value() {
+    IsolateState* state = IsolateState::Current();
+    if (index_ >= state->tags.size()) state->tags.resize(index_ + 1);
+    v8::Persistent<v8::External>& handle = state->tags[index_];
+    if (handle.IsEmpty())
+      handle = v8::Persistent<v8::External>::New(__v8_new_external(this));
+    return v8::Local<v8::External>::New(handle);
+  }
+private:
+  typedef std::vector<const TypeTag*> List;
+#if __cplusplus >= 201103L
+  typedef std::atomic<const List*> ListPointer;
+#else
+  typedef const List* volatile ListPointer;
+#endif
+
+  static inline Mutex& Lock() {
+    static Mutex mutex;
+    return mutex;
+  }
+
+  size_t index_;
+  TypeTag* parent_;
+  ListPointer descendants_;
+};
+
+template <class T> inline TypeTag& TypeTagOf() {
+  static TypeTag tag;
+  return tag;
+}
+
+template <class T> inline void SetTag(v8::Handle<v8::Object> obj) {
+  if (obj->InternalFieldCount() < 2) return;
+  obj->SetInternalField(1, TypeTagOf<T>().Value());
+}
+
+//// Whether T has the static __v8_build() that NODE_TYPE defines
+template <class T> struct HasBuild {
+  template <class U, void (*)()> struct Check;
+  template <class U> static char Test(Check<U, &U::__v8_build>*);
+  template <class U> static long Test(...);
+  enum { value = sizeof(Test<T>(0)) == sizeof(char) };
+};
+
+template <bool> struct BuildIf {
+  template <class T> static inline void Run() {}
+};
+template <> struct BuildIf<true> {
+  template <class T> static inline void Run() {
+    T::__v8_build();
+  }
+};
+
+//// Builds the template of a type that wasn't initialized yet (see
+//// NODE_DEF_LAZY), without exporting it anywhere
+template <class T> inline void Build() {
+  BuildIf<HasBuild<T>::value>::template Run<T>();
+}
+
+template <class T>
+inline void Inherit(v8::Handle<v8::FunctionTemplate> templ, TypeTag* tag) {
+  if (T::templ_.IsEmpty()) Build<T>();
+  templ->Inherit(v8::Handle<v8::FunctionTemplate>(T::templ_));
+  if (tag) tag->Inherit(&TypeTagOf<T>());
+}
+
+template <class T> inline bool IsTagged(v8::Handle<v8::Value> value) {
+  if (value.IsEmpty() || !value->IsObject()) return false;
+  v8::Handle<v8::Object> obj = v8::Handle<v8::Object>::Cast(value);
+  if (obj->InternalFieldCount() < 2) return false;
+  v8::Local<v8::Value> tag = obj->GetInternalField(1);
+  if (tag.IsEmpty() || !tag->IsExternal()) return false;
+  return TypeTagOf<T>().Covers(v8::External::Cast(*tag)->Value());
+}
+
+//// Whether T (or a base) was declared with V8_TYPE, which defines __v8_wrap()
+template <class T> struct HasWrap {
+  template <class U> static char Test(typename U::__v8_wrap_tag*);
+  template <class U> static long Test(...);
+  enum { value = sizeof(Test<T>(0)) == sizeof(char) };
+};
+
+//// ObjectWrap::Wrap is protected, this reaches it from outside the class
+struct PlainWrap : node::ObjectWrap {
+  static inline void Run(node::ObjectWrap* inst, v8::Handle<v8::Object> hdl) {
+    (inst->*&PlainWrap::Wrap)(hdl);
+  }
+};
+
+template <bool> struct WrapIf {
+  template <class T>
+  static inline void Run(T* inst, v8::Handle<v8::Object> hdl) {
+    PlainWrap::Run(inst, hdl);
+  }
+};
+template <> struct WrapIf<true> {
+  template <class T>
+  static inline void Run(T* inst, v8::Handle<v8::Object> hdl) {
+    inst->__v8_wrap(hdl);
+  }
+};
+
+//// Tags as the dynamic type with V8_TYPE, only wraps without (NODE_DEF_TYPE)
+template <class T> inline void Wrap(T* inst, v8::Handle<v8::Object> hdl) {
+  WrapIf<HasWrap<T>::value>::template Run<T>(inst, hdl);
+}
+
+template <bool> struct CheckTemplateIf {
+  template <class T> static inline void Run(v8::Handle<v8::Object> obj) {}
+};
+template <> struct CheckTemplateIf<true> {
+  template <class T> static inline void Run(v8::Handle<v8::Object> obj) {
+    assert(T::templ_.IsEmpty() || T::templ_->HasInstance(obj));
+  }
+};
+
+//// Debug-only cross-check: whatever is tagged as a V8_TYPE passes its templ_
+template <class T> inline void CheckTemplate(v8::Handle<v8::Object> obj) {
+  CheckTemplateIf<HasWrap<T>::value>::template Run<T>(obj);
+}
+
+//// The instance behind a tagged object, NULL if it isn't one (or is empty)
+template <class T> inline T* Self(v8::Handle<v8::Object> obj) {
+  if (!IsTagged<T>(obj) || !__v8_get_pointer(obj, 0)) return NULL;
+  CheckTemplate<T>(obj);
+  return node::ObjectWrap::Unwrap<T>(obj);
+}
+
+};
+
 // Other class-specific templates
 
 #define __v8_ctor {                                                            \
+  __v8_returns(__v8_cb_return)                                                 \
   v8::Local<v8::Object> hdl = info.This();                                     \
   if (info[0]->IsExternal()) return hdl;                                       \
   if (!info.IsConstructCall())                                                 \
     V8_STHROW(v8u::ReferenceErr("You must call this as a constructor"));       \
-  V8_WRAP_START()
+  __v8_cb_start
 
 #define V8_SCTOR() static V8_SCB(NewInstance)
 #define V8_ESCTOR(TYPE)   V8_SCB(TYPE::NewInstance)
@@ -190,14 +858,28 @@ V8_SSET(IDENTIFIER) {                                                          \
   V8_STHROW(v8u::TypeErr("You can't construct instances of this type directly."));
 //------------------------------------------------------------------------------
 
-//// For use with V8_CTOR only!
-#define V8_WRAP(INSTANCE) (INSTANCE)->Wrap(hdl)
+/**
+ * For use with V8_CTOR only! With V8_TYPE, the object is tagged as
+ * INSTANCE's dynamic type; classes with only NODE_DEF_TYPE are just wrapped.
+ **/
+#define V8_WRAP(INSTANCE) v8u::internal::Wrap(INSTANCE, hdl)
 
 #define V8_M_UNWRAP(CPP_TYPE, OBJ)                                             \
-  if (!CPP_TYPE::templ_->HasInstance(OBJ))                                     \
+  if (!v8u::internal::IsTagged<CPP_TYPE>(OBJ) &&                               \
+      (CPP_TYPE::templ_.IsEmpty() || !CPP_TYPE::templ_->HasInstance(OBJ)))     \
     V8_STHROW(v8u::TypeErr("Invalid object unwrapped."));                      \
   CPP_TYPE* inst = node::ObjectWrap::Unwrap<CPP_TYPE>(OBJ);
 
+/**
+ * For methods defined with V8_DEF_CB. V8 already checked the receiver's
+ * template, but that doesn't mean it holds a live CPP_TYPE (it may never
+ * have been wrapped, or a WrapCache may have dropped it), so the tag and
+ * the pointer are checked too.
+ **/
+#define V8_M_SELF(CPP_TYPE)                                                    \
+  CPP_TYPE* inst = v8u::internal::Self<CPP_TYPE>(info.Holder());               \
+  if (!inst) V8_STHROW(v8u::TypeErr("Invalid object unwrapped."));
+
 // Type functions
 
 #if NODE_VERSION_AT_LEAST(0,11,4)
@@ -208,7 +890,7 @@ V8_SSET(IDENTIFIER) {                                                          \
 #endif
 
 #define V8_STYPE(CPP_TYPE)                                                     \
-  static v8::FunctionTemplate* templ_;                                         \
+  static v8u::TypeSlot templ_;                                                 \
   __node_handle_pollyfill                                                      \
   /**
    * Returns the unique V8 v8::Object corresponding to this C++ instance.
@@ -218,16 +900,18 @@ V8_SSET(IDENTIFIER) {                                                          \
    * EVENTUALLY MAKING YOU BASH YOUR HEAD AGAINST A WALL. YOU HAVE BEEN WARNED.
    **/                                                                         \
   virtual v8::Local<v8::Object> Wrapped();                                     \
+  typedef void __v8_wrap_tag;                                                  \
+  virtual void __v8_wrap(v8::Handle<v8::Object> handle);                       \
   static bool HasInstance(v8::Handle<v8::Object> obj);                         \
   inline static CPP_TYPE* Unwrap(v8::Handle<v8::Object> obj)
 
 #define V8_TYPE(CPP_TYPE)                                                      \
-  static v8::FunctionTemplate* templ_;                                         \
+  static v8u::TypeSlot templ_;                                                 \
   __node_handle_pollyfill                                                      \
   /**
    * Returns the unique V8 v8::Object corresponding to this C++ instance.
-   * For this to work, you should use V8_[E]CTOR.
-   * V8_[E]SCTOR with V8_CTOR_NO_JS will work as well.
+   * New objects come straight from the instance template, the constructor
+   * isn't called.
    *
    * CALLING Wrapped() WITHIN A CONSTRUCTOR MAY YIELD UNEXPECTED RESULTS,
    * EVENTUALLY MAKING YOU BASH YOUR HEAD AGAINST A WALL. YOU HAVE BEEN WARNED.
@@ -237,18 +921,31 @@ V8_SSET(IDENTIFIER) {                                                          \
                                                                                \
     v8::Handle<v8::Object> handle = this->handle();                            \
     if (handle.IsEmpty()) {                                                    \
-      v8::Handle<v8::Value> args [1] = {v8::External::New(this)};              \
-      handle = templ_->GetFunction()->NewInstance(1,args);                     \
-      Wrap(handle);                                                            \
+      if (templ_.IsEmpty()) v8u::internal::Build<CPP_TYPE>();                  \
+      handle = templ_->InstanceTemplate()->NewInstance();                      \
+      __v8_wrap(handle);                                                       \
     }                                                                          \
     return scope.Close(handle);                                                \
   }                                                                            \
+  typedef void __v8_wrap_tag;                                                  \
+  /** Tags, wraps and accounts HANDLE as this (most derived) type **/          \
+  virtual void __v8_wrap(v8::Handle<v8::Object> handle) {                      \
+    v8u::internal::SetTag<CPP_TYPE>(handle);                                   \
+    v8u::internal::Account(this)->Wrap(handle);                                \
+  }                                                                            \
   static bool HasInstance(v8::Handle<v8::Object> obj) {                        \
-    return templ_->HasInstance(obj);                                           \
+    if (v8u::internal::IsTagged<CPP_TYPE>(obj)) return true;                   \
+    return !templ_.IsEmpty() && templ_->HasInstance(obj);                      \
   }                                                                            \
   inline static CPP_TYPE* Unwrap(v8::Handle<v8::Object> obj) {                 \
-    if (templ_->HasInstance(obj)) return node::ObjectWrap::Unwrap<CPP_TYPE>(obj);\
-    V8_THROW(v8::Exception::TypeError(v8::String::New("Invalid object unwrapped.")));\
+    if (v8u::internal::IsTagged<CPP_TYPE>(obj)) {                              \
+      v8u::internal::CheckTemplate<CPP_TYPE>(obj);                             \
+      return node::ObjectWrap::Unwrap<CPP_TYPE>(obj);                          \
+    }                                                                          \
+    if (!templ_.IsEmpty() && templ_->HasInstance(obj))                         \
+      return node::ObjectWrap::Unwrap<CPP_TYPE>(obj);                          \
+    __v8_raise(v8::Exception::TypeError(v8::String::New("Invalid object unwrapped.")));\
+    return NULL;                                                               \
   }
 
 #define V8_ETYPE(TYPE)                                                         \
@@ -257,21 +954,209 @@ V8_SSET(IDENTIFIER) {                                                          \
                                                                                \
     v8::Handle<v8::Object> handle = this->handle();                            \
     if (handle.IsEmpty()) {                                                    \
-      v8::Handle<v8::Value> args [1] = {v8::External::New(this)};              \
-      handle = templ_->GetFunction()->NewInstance(1,args);                     \
-      Wrap(handle);                                                            \
+      if (templ_.IsEmpty()) v8u::internal::Build<TYPE>();                      \
+      handle = templ_->InstanceTemplate()->NewInstance();                      \
+      __v8_wrap(handle);                                                       \
     }                                                                          \
     return scope.Close(handle);                                                \
   }                                                                            \
+  void TYPE::__v8_wrap(v8::Handle<v8::Object> handle) {                        \
+    v8u::internal::SetTag<TYPE>(handle);                                       \
+    v8u::internal::Account(this)->Wrap(handle);                                \
+  }                                                                            \
   bool TYPE::HasInstance(v8::Handle<v8::Object> obj) {                         \
-    return templ_->HasInstance(obj);                                           \
+    if (v8u::internal::IsTagged<TYPE>(obj)) return true;                       \
+    return !templ_.IsEmpty() && templ_->HasInstance(obj);                      \
   }                                                                            \
   TYPE* TYPE::Unwrap(v8::Handle<v8::Object> obj) {                             \
-    if (templ_->HasInstance(obj)) return node::ObjectWrap::Unwrap<TYPE>(obj);  \
-    V8_THROW(v8u::TypeErr("Invalid object unwrapped."));                       \
+    if (v8u::internal::IsTagged<TYPE>(obj)) {                                  \
+      v8u::internal::CheckTemplate<TYPE>(obj);                                 \
+      return node::ObjectWrap::Unwrap<TYPE>(obj);                              \
+    }                                                                          \
+    if (!templ_.IsEmpty() && templ_->HasInstance(obj))                         \
+      return node::ObjectWrap::Unwrap<TYPE>(obj);                              \
+    __v8_raise(v8u::TypeErr("Invalid object unwrapped."));                     \
+    return NULL;                                                               \
+  }
+
+#define V8_POST_TYPE(CPP_TYPE) v8u::TypeSlot CPP_TYPE::templ_;
+
+// Pooled allocation (opt in with V8_POOLED or the *_POOLED type macros)
+
+//// Objects per slab
+#ifndef V8U_POOL_SLAB
+  #define V8U_POOL_SLAB 128
+#endif
+
+/**
+ * Slab allocator for objects of one type. Every thread (and so every
+ * isolate) has its own free list, so allocating and freeing on the same
+ * thread takes no lock. Allocations of another size (subclasses not
+ * declaring their own pool) go to the global operator new.
+ *
+ * Every slot remembers the thread state it came from. Objects deleted on
+ * another thread go back to that state, on a locked list its owner takes
+ * over when it runs out of slots. When a thread exits, its slabs are
+ * handed back to malloc as soon as none of its objects is alive (only
+ * with C++11: older compilers have no thread exit hook, so they're kept).
+ *
+ * Live() and Free() count slots of the calling thread.
+ **/
+template <class T> class Pool {
+public:
+  static void* Allocate(size_t size) {
+    if (size != sizeof(T)) return ::operator new(size);
+    State& state = Current();
+    if (!state.head) Reclaim(state);
+    if (!state.head) Grow(state);
+    Slot* slot = state.head;
+    state.head = slot->next;
+    state.free--;
+    state.live++;
+    return slot;
+  }
+  static void Release(void* ptr, size_t size) {
+    if (!ptr) return;
+    if (size != sizeof(T)) return ::operator delete(ptr);
+    Slot* slot = static_cast<Slot*>(ptr);
+    State* state = slot->owner;
+    if (state == Local()) {
+      slot->next = state->head;
+      state->head = slot;
+      state->free++;
+      state->live--;
+      return;
+    }
+    state->mutex.Lock();
+    slot->next = state->remote;
+    state->remote = slot;
+    state->returned++;
+    bool last = state->exited && state->live == state->returned;
+    state->mutex.Unlock();
+    if (last) Destroy(state);
+  }
+
+  static inline long Live() {
+    State& state = Current();
+    state.mutex.Lock();
+    long live = state.live - state.returned;
+    state.mutex.Unlock();
+    return live;
+  }
+  static inline long Free() {
+    State& state = Current();
+    state.mutex.Lock();
+    long free = state.free + state.returned;
+    state.mutex.Unlock();
+    return free;
+  }
+  static inline long Slabs() {
+    return Current().slabs.size();
+  }
+  static v8::Local<v8::Object> Stats() {
+    v8::Local<v8::Object> stats = v8::Object::New();
+    stats->Set(v8::String::NewSymbol("live"), v8::Number::New(Live()));
+    stats->Set(v8::String::NewSymbol("free"), v8::Number::New(Free()));
+    stats->Set(v8::String::NewSymbol("slabs"), v8::Number::New(Slabs()));
+    return stats;
+  }
+private:
+  struct State;
+  struct Slot {
+    union {
+      Slot* next;
+      char data [sizeof(T)];
+      double align_double;
+      long double align_long_double;
+      void* align_pointer;
+    };
+    State* owner;
+  };
+  struct State {
+    Slot* head;
+    long live;
+    long free;
+    std::vector<Slot*> slabs;
+    //// The rest is shared with other threads, under the mutex
+    internal::Mutex mutex;
+    Slot* remote;
+    long returned;
+    bool exited;
+
+    inline State() : head(NULL), live(0), free(0), remote(NULL),
+                     returned(0), exited(false) {}
+  };
+
+  static inline State*& Local() {
+    static __v8_thread_local State* state = NULL;
+    return state;
   }
+  static inline State& Current() {
+    State*& state = Local();
+    if (!state) {
+      state = new State();
+#if __cplusplus >= 201103L
+      static thread_local Exit guard;
+      guard.state = state;
+#endif
+    }
+    return *state;
+  }
+  //// Takes back the slots other threads freed
+  static void Reclaim(State& state) {
+    state.mutex.Lock();
+    state.head = state.remote;
+    state.free += state.returned;
+    state.live -= state.returned;
+    state.remote = NULL;
+    state.returned = 0;
+    state.mutex.Unlock();
+  }
+  static void Grow(State& state) {
+    Slot* slab = static_cast<Slot*>(::operator new(sizeof(Slot) * V8U_POOL_SLAB));
+    for (int i = V8U_POOL_SLAB - 1; i >= 0; i--) {
+      slab[i].owner = &state;
+      slab[i].next = state.head;
+      state.head = slab + i;
+    }
+    state.free += V8U_POOL_SLAB;
+    state.slabs.push_back(slab);
+  }
+  static void Destroy(State* state) {
+    for (size_t i = 0; i < state->slabs.size(); i++)
+      ::operator delete(state->slabs[i]);
+    delete state;
+  }
+
+#if __cplusplus >= 201103L
+  //// Runs at thread exit; the last object freed elsewhere may finish it
+  struct Exit {
+    State* state = NULL;
+    ~Exit() {
+      if (!state) return;
+      Local() = NULL;
+      state->mutex.Lock();
+      state->exited = true;
+      bool last = state->live == state->returned;
+      state->mutex.Unlock();
+      if (last) Destroy(state);
+    }
+  };
+#endif
+};
 
-#define V8_POST_TYPE(CPP_TYPE) v8::FunctionTemplate* CPP_TYPE::templ_ = NULL;
+//// Put it inside a class to allocate its instances from a Pool
+#define V8_POOLED(CPP_TYPE)                                                    \
+  static void* operator new(size_t size) {                                     \
+    return v8u::Pool<CPP_TYPE>::Allocate(size);                                \
+  }                                                                            \
+  static void operator delete(void* ptr, size_t size) {                        \
+    v8u::Pool<CPP_TYPE>::Release(ptr, size);                                   \
+  }
+
+#define V8_TYPE_POOLED(CPP_TYPE)                                               \
+  V8_POOLED(CPP_TYPE)                                                          \
+  V8_TYPE(CPP_TYPE)
 
 // Dealing with V8 persistent handles
 
@@ -298,7 +1183,20 @@ public:
   inline ~Persisted() {
     if (!handle.IsEmpty()) handle.Dispose();
   }
-  inline Persisted(Persisted<T>& other) : handle(v8::Persistent<T>::New(other.handle)) {}
+  inline Persisted(const Persisted<T>& other) : handle(v8::Persistent<T>::New(other.handle)) {}
+#if __cplusplus >= 201103L
+  //// Moving hands the same global handle over, no new one is created
+  inline Persisted(Persisted<T>&& other) noexcept : handle(other.handle) {
+    other.handle.Clear();
+  }
+  inline Persisted<T>& operator=(Persisted<T>&& other) noexcept {
+    if (&other == this) return *this;
+    ClearPersistent<T>(handle);
+    handle = other.handle;
+    other.handle.Clear();
+    return *this;
+  }
+#endif
   inline v8::Persistent<T> operator*() const {
     return handle;
   }
@@ -323,32 +1221,363 @@ private:
   v8::Persistent<T> handle;
 };
 
-// Type shortcuts
+// Weak handles
 
-inline v8::Local<v8::Integer> Int(int64_t integer) {
-  return v8::Integer::New(integer);
-}
+namespace internal {
 
-inline v8::Local<v8::Integer> Uint(uint32_t integer) {
-  return v8::Integer::NewFromUnsigned(integer);
+#if NODE_VERSION_AT_LEAST(0,11,3)
+template <class T, class P, void (*Callback)(v8::Persistent<T>&, P*)>
+void WeakTrampoline(v8::Isolate* isolate, v8::Persistent<T>* handle, P* param) {
+  Callback(*handle, param);
 }
-
-inline v8::Local<v8::String> Str(const char* data, int length = -1) {
-  return v8::String::New(data, length);
+#else
+template <class T, class P, void (*Callback)(v8::Persistent<T>&, P*)>
+void WeakTrampoline(v8::Persistent<v8::Value> handle, void* param) {
+  v8::Persistent<T> typed = v8::Persistent<T>::Cast(handle);
+  Callback(typed, static_cast<P*>(param));
 }
+#endif
 
-inline v8::Local<v8::String> Str(std::string str) {
-  return v8::String::New(str.data(), str.length());
+};
+
+/**
+ * Makes the handle weak, the same way on every V8 version. Callback runs
+ * when the object is about to be collected, and must dispose the handle.
+ **/
+template <class T, class P, void (*Callback)(v8::Persistent<T>&, P*)>
+inline void MakeWeak(v8::Persistent<T>& handle, P* param) {
+  handle.MakeWeak(param, internal::WeakTrampoline<T, P, Callback>);
 }
 
-inline v8::Local<v8::String> Symbol(const char* data, int length = -1) {
+namespace internal {
+
+//// How WrapCache stores a T*: as is, unless T is a V8_TYPE
+template <bool> struct CachePointer {
+  template <class T> static inline void Tag(v8::Handle<v8::Object> obj) {}
+  template <class T> static inline void* To(T* ptr) {
+    return ptr;
+  }
+  template <class T> static inline T* From(void* ptr) {
+    return static_cast<T*>(ptr);
+  }
+};
+//// Like ObjectWrap::Wrap, which node::ObjectWrap::Unwrap expects
+template <> struct CachePointer<true> {
+  template <class T> static inline void Tag(v8::Handle<v8::Object> obj) {
+    SetTag<T>(obj);
+  }
+  template <class T> static inline void* To(T* ptr) {
+    return static_cast<node::ObjectWrap*>(ptr);
+  }
+  template <class T> static inline T* From(void* ptr) {
+    return static_cast<T*>(static_cast<node::ObjectWrap*>(ptr));
+  }
+};
+
+};
+
+/**
+ * Hands out JS objects for native objects that JS doesn't own (nodes of a
+ * graph, entries of a cache...). Asking twice for the same pointer gives
+ * the same object for as long as JS holds on to it; once collected, the
+ * entry goes away and the native object is left alone.
+ *
+ * Objects are created from the instance template of the given
+ * FunctionTemplate (which needs an internal field, V8_DEF_TYPE does that)
+ * without calling the constructor. Use Unwrap() to get the pointer back,
+ * and Remove() if the native object dies first. If T is a V8_TYPE, objects
+ * are tagged and hold the pointer the way V8_WRAP leaves them, so its
+ * V8_DEF_CB methods work on them (until Remove()); pass T::templ_ (or a
+ * subtype's) then, debug builds assert it.
+ **/
+template <class T> class WrapCache {
+public:
+  inline WrapCache() {}
+  inline ~WrapCache() {
+    Clear();
+  }
+
+  template <class Templ>
+  v8::Local<v8::Object> Get(T* ptr, const Templ& templ) {
+    V8_HANDLE_SCOPE(scope);
+    typename Map::iterator it = map_.find(ptr);
+    if (it != map_.end()) return scope.Close(v8::Local<v8::Object>::New(it->second.handle));
+
+    v8::Local<v8::Object> obj = templ->InstanceTemplate()->NewInstance();
+    if (obj.IsEmpty()) return scope.Close(obj);
+    Pointer::template Tag<T>(obj);
+    __v8_set_pointer(obj, 0, Pointer::To(ptr));
+
+    Entry& entry = map_[ptr];
+    entry.cache = this;
+    entry.ptr = ptr;
+    entry.handle = v8::Persistent<v8::Object>::New(obj);
+    MakeWeak<v8::Object, Entry, &WrapCache::Collected>(entry.handle, &entry);
+    return scope.Close(obj);
+  }
+
+  //// The object stays alive in JS, but Unwrap() will give NULL from now on
+  void Remove(T* ptr) {
+    typename Map::iterator it = map_.find(ptr);
+    if (it == map_.end()) return;
+    __v8_set_pointer(it->second.handle, 0, NULL);
+    Release(it);
+  }
+  void Clear() {
+    while (!map_.empty()) Remove(map_.begin()->first);
+  }
+  inline bool Has(T* ptr) const {
+    return map_.count(ptr);
+  }
+  inline size_t Size() const {
+    return map_.size();
+  }
+
+  static inline T* Unwrap(v8::Handle<v8::Object> obj) {
+    if (obj.IsEmpty() || obj->InternalFieldCount() < 1) return NULL;
+    return Pointer::template From<T>(__v8_get_pointer(obj, 0));
+  }
+private:
+  WrapCache(const WrapCache&);
+  WrapCache& operator=(const WrapCache&);
+
+  typedef internal::CachePointer<internal::HasWrap<T>::value> Pointer;
+
+  struct Entry {
+    WrapCache* cache;
+    T* ptr;
+    v8::Persistent<v8::Object> handle;
+  };
+  typedef std::map<T*, Entry> Map;
+
+  static void Collected(v8::Persistent<v8::Object>& handle, Entry* entry) {
+    handle.Dispose();
+    handle.Clear();
+    WrapCache* cache = entry->cache;
+    cache->map_.erase(entry->ptr);
+  }
+  inline void Release(typename Map::iterator it) {
+    it->second.handle.ClearWeak();
+    it->second.handle.Dispose();
+    map_.erase(it);
+  }
+
+  Map map_;
+};
+
+// Persistent containers
+
+/**
+ * Values kept alive from C++, all behind one global handle (an array), so
+ * adding and removing them doesn't touch the global handle table.
+ **/
+template <class T> class PersistentVector {
+public:
+  inline PersistentVector() : size_(0) {}
+  inline ~PersistentVector() {
+    ClearPersistent<v8::Array>(array_);
+  }
+
+  inline void Push(v8::Handle<T> value) {
+    Set(size_, value);
+  }
+  void Set(uint32_t index, v8::Handle<T> value) {
+    if (array_.IsEmpty()) array_ = v8::Persistent<v8::Array>::New(v8::Array::New());
+    array_->Set(index, value);
+    if (index >= size_) size_ = index + 1;
+  }
+  inline v8::Local<T> Get(uint32_t index) const {
+    if (index >= size_) return v8::Local<T>();
+    return v8::Local<T>::Cast(array_->Get(index));
+  }
+  inline v8::Local<T> operator[](uint32_t index) const {
+    return Get(index);
+  }
+  inline size_t Size() const {
+    return size_;
+  }
+  inline void Clear() {
+    ClearPersistent<v8::Array>(array_);
+    size_ = 0;
+  }
+private:
+  PersistentVector(const PersistentVector&);
+  PersistentVector& operator=(const PersistentVector&);
+
+  v8::Persistent<v8::Array> array_;
+  uint32_t size_;
+};
+
+/**
+ * Map from C++ keys to JS values. Strong entries live in slots of a
+ * single array, like PersistentVector, and freed slots are reused. Weak
+ * entries (SetWeak) need a global handle each, and disappear from the
+ * map once their value is collected. Clear() drops everything at once.
+ **/
+template <class K, class T> class PersistentMap {
+public:
+  inline PersistentMap() {}
+  inline ~PersistentMap() {
+    Clear();
+  }
+
+  void Set(const K& key, v8::Handle<T> value) {
+    Entry& entry = Slot(key);
+    if (entry.slot == NONE) {
+      if (slots_.IsEmpty()) slots_ = v8::Persistent<v8::Array>::New(v8::Array::New());
+      if (free_.empty()) {
+        entry.slot = slots_->Length();
+      } else {
+        entry.slot = free_.back();
+        free_.pop_back();
+      }
+    }
+    slots_->Set(entry.slot, value);
+  }
+  void SetWeak(const K& key, v8::Handle<T> value) {
+    Entry& entry = Slot(key);
+    ReleaseSlot(entry);
+    entry.weak = v8::Persistent<T>::New(value);
+    MakeWeak<T, Entry, &PersistentMap::Collected>(entry.weak, &entry);
+  }
+
+  v8::Local<T> Get(const K& key) const {
+    typename Map::const_iterator it = entries_.find(key);
+    if (it == entries_.end()) return v8::Local<T>();
+    if (it->second.slot != NONE)
+      return v8::Local<T>::Cast(slots_->Get(it->second.slot));
+    return v8::Local<T>::New(it->second.weak);
+  }
+  inline bool Has(const K& key) const {
+    return entries_.count(key);
+  }
+  bool Remove(const K& key) {
+    typename Map::iterator it = entries_.find(key);
+    if (it == entries_.end()) return false;
+    ReleaseSlot(it->second);
+    entries_.erase(it);
+    return true;
+  }
+  inline size_t Size() const {
+    return entries_.size();
+  }
+  void Clear() {
+    for (typename Map::iterator it = entries_.begin(); it != entries_.end(); ++it)
+      ReleaseWeak(it->second);
+    entries_.clear();
+    free_.clear();
+    ClearPersistent<v8::Array>(slots_);
+  }
+private:
+  PersistentMap(const PersistentMap&);
+  PersistentMap& operator=(const PersistentMap&);
+
+  static const uint32_t NONE = 0xFFFFFFFF;
+
+  struct Entry {
+    PersistentMap* map;
+    K key;
+    uint32_t slot;
+    v8::Persistent<T> weak;
+  };
+  typedef std::map<K, Entry> Map;
+
+  inline Entry& Slot(const K& key) {
+    typename Map::iterator it = entries_.find(key);
+    if (it != entries_.end()) {
+      ReleaseWeak(it->second);
+      return it->second;
+    }
+    Entry& entry = entries_[key];
+    entry.map = this;
+    entry.key = key;
+    entry.slot = NONE;
+    return entry;
+  }
+  inline void ReleaseSlot(Entry& entry) {
+    ReleaseWeak(entry);
+    if (entry.slot == NONE) return;
+    slots_->Set(entry.slot, v8::Undefined());
+    free_.push_back(entry.slot);
+    entry.slot = NONE;
+  }
+  static inline void ReleaseWeak(Entry& entry) {
+    if (entry.weak.IsEmpty()) return;
+    entry.weak.ClearWeak();
+    entry.weak.Dispose();
+    entry.weak.Clear();
+  }
+  static void Collected(v8::Persistent<T>& handle, Entry* entry) {
+    handle.Dispose();
+    handle.Clear();
+    Map& entries = entry->map->entries_;
+    entries.erase(entries.find(entry->key));
+  }
+
+  Map entries_;
+  std::vector<uint32_t> free_;
+  v8::Persistent<v8::Array> slots_;
+};
+
+// Type shortcuts
+
+inline v8::Local<v8::Integer> Int(int64_t integer) {
+  return v8::Integer::New(integer);
+}
+
+inline v8::Local<v8::Integer> Uint(uint32_t integer) {
+  return v8::Integer::NewFromUnsigned(integer);
+}
+
+inline v8::Local<v8::String> Str(const char* data, int length = -1) {
+  return v8::String::New(data, length);
+}
+
+inline v8::Local<v8::String> Str(const std::string& str) {
+  return v8::String::New(str.data(), str.length());
+}
+
+inline v8::Local<v8::String> Symbol(const char* data, int length = -1) {
   return v8::String::NewSymbol(data, length);
 }
 
-inline v8::Local<v8::String> Symbol(std::string str) {
+inline v8::Local<v8::String> Symbol(const std::string& str) {
   return v8::String::NewSymbol(str.data(), str.length());
 }
 
+//// Holds one interned string, created the first time it's asked for
+class SymbolSlot {
+public:
+  inline SymbolSlot() : index_(internal::IsolateState::NewSymbolIndex()) {}
+  inline v8::Local<v8::String> Get(const char* data, int length) {
+    std::vector<v8::Persistent<v8::String> >& symbols =
+        internal::IsolateState::Current()->symbols;
+    if (index_ >= symbols.size()) symbols.resize(index_ + 1);
+    v8::Persistent<v8::String>& handle = symbols[index_];
+    if (handle.IsEmpty()) handle = v8::Persistent<v8::String>::New(Symbol(data, length));
+    return v8::Local<v8::String>::New(handle);
+  }
+private:
+  size_t index_;
+};
+
+/**
+ * Like Symbol(), but LITERAL (which must be a string literal) gets its own
+ * static slot, so after the first call it's just a handle copy: no hashing
+ * and no string table lookup. Use it for property names in hot code.
+ * It's opt-in: the V8_DEF_* and NODE_* macros take any string, so they
+ * keep calling Symbol().
+ **/
+#if __cplusplus >= 201103L
+  #define V8U_SYMBOL(LITERAL)                                                  \
+    ([]() -> v8::Local<v8::String> {                                           \
+      static v8u::SymbolSlot slot;                                             \
+      return slot.Get("" LITERAL, sizeof(LITERAL) - 1);                        \
+    }())
+#else
+  #define V8U_SYMBOL(LITERAL) v8u::Symbol("" LITERAL, sizeof(LITERAL) - 1)
+#endif
+
 inline v8::Local<v8::Object> Obj() {
   return v8::Object::New();
 }
@@ -445,105 +1674,2130 @@ inline bool Bool(v8::Handle<v8::Value> hdl) {
   return hdl->BooleanValue();
 }
 
-// Defining things
+// Typed argument binding
 
-#define V8_DEF_TYPE_PRE()                                                      \
-  v8::Persistent<v8::FunctionTemplate> templ;                                  \
-  v8::Local<v8::ObjectTemplate> prot;                                          \
-  v8::Local<v8::ObjectTemplate> inst;                                          \
-  v8::Handle<v8::String> __cname;
+#if __cplusplus >= 201103L
 
-#define V8_DEF_TYPE(V8_NAME)                                                   \
-  templ = v8::Persistent<v8::FunctionTemplate>::New(                           \
-      v8::FunctionTemplate::New(NewInstance));                                 \
-  __cname = v8::String::NewSymbol(V8_NAME);                                    \
-  templ->SetClassName(__cname);                                                \
-  inst = templ->InstanceTemplate();                                            \
-  inst->SetInternalFieldCount(1);                                              \
-  prot = templ->PrototypeTemplate();
+/**
+ * Conversions between JS values and C++ types, used by V8_BIND.
+ * Is() checks the type (no coercion), Get() converts to C++ and New() goes
+ * back to JS. Specialize it to bind your own types.
+ **/
+template <class T> struct ArgTraits;
 
-#define V8_DEF_ACC(V8_NAME, GETTER, SETTER)                                    \
-  inst->SetAccessor(v8::String::NewSymbol(V8_NAME), GETTER, SETTER)
+#define __v8_arg_traits(TYPE, EXPECTED, IS, GET, NEW)                          \
+template <> struct ArgTraits<TYPE> {                                           \
+  static inline const char* Expected() { return EXPECTED; }                    \
+  static inline bool Is(v8::Handle<v8::Value> hdl) { return hdl->IS(); }       \
+  static inline TYPE Get(v8::Handle<v8::Value> hdl) { return GET; }            \
+  static inline v8::Handle<v8::Value> New(const TYPE& value) { return NEW; }   \
+};
 
-#define V8_DEF_GET(V8_NAME, GETTER)                                            \
-  inst->SetAccessor(v8::String::NewSymbol(V8_NAME), GETTER)
+__v8_arg_traits(int32_t, "a number", IsNumber, hdl->Int32Value(), Int(value))
+__v8_arg_traits(uint32_t, "a number", IsNumber, hdl->Uint32Value(), Uint(value))
+//// Integer::New only takes 32 bits on these V8s, so it goes out as a double
+__v8_arg_traits(int64_t, "a number", IsNumber, hdl->IntegerValue(), Num(double(value)))
+__v8_arg_traits(double, "a number", IsNumber, hdl->NumberValue(), Num(value))
+__v8_arg_traits(bool, "a boolean", IsBoolean, hdl->BooleanValue(), Bool(value))
+__v8_arg_traits(v8::Local<v8::Object>, "an object", IsObject,
+    v8::Local<v8::Object>(v8::Object::Cast(*hdl)), value)
+__v8_arg_traits(v8::Local<v8::Array>, "an array", IsArray,
+    v8::Local<v8::Array>(v8::Array::Cast(*hdl)), value)
+__v8_arg_traits(v8::Local<v8::Function>, "a function", IsFunction,
+    v8::Local<v8::Function>(v8::Function::Cast(*hdl)), value)
+__v8_arg_traits(v8::Local<v8::String>, "a string", IsString,
+    v8::Local<v8::String>(v8::String::Cast(*hdl)), value)
+
+template <> struct ArgTraits<v8::Local<v8::Value> > {
+  static inline const char* Expected() { return "a value"; }
+  static inline bool Is(v8::Handle<v8::Value> hdl) { return true; }
+  static inline v8::Local<v8::Value> Get(v8::Handle<v8::Value> hdl) {
+    return v8::Local<v8::Value>(*hdl);
+  }
+  static inline v8::Handle<v8::Value> New(v8::Handle<v8::Value> value) {
+    return value;
+  }
+};
 
-//FIXME: add V8_DEF_SET
+namespace internal {
 
-#define V8_DEF_CB(V8_NAME, CPP_METHOD)                                         \
-  inst->Set(v8u::Symbol(V8_NAME), v8u::Func(CPP_METHOD))
+template <int... I> struct Indices {};
+template <int N, int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <int... I> struct MakeIndices<0, I...> {
+  typedef Indices<I...> type;
+};
 
-#define V8_INHERIT(CPP_TYPE) templ->Inherit(CPP_TYPE::templ_)
+template <class R> struct BindReturn {
+  template <class F, class... A>
+  static inline v8::Handle<v8::Value> Call(F function, A&&... args) {
+    return ArgTraits<R>::New(function(std::forward<A>(args)...));
+  }
+};
+template <> struct BindReturn<void> {
+  template <class F, class... A>
+  static inline v8::Handle<v8::Value> Call(F function, A&&... args) {
+    function(std::forward<A>(args)...);
+    return v8::Undefined();
+  }
+};
 
-// Templates for definition methods on Node
+inline v8::Local<v8::Value> ArgumentErr(int index, const char* expected) {
+  char message [192];
+  snprintf(message, sizeof(message), "Argument %d must be %s.", index, expected);
+  return TypeErr(message);
+}
 
-//// Generic define function
+};
 
-#define NODE_DEF(IDENTIFIER)                                                   \
-  void IDENTIFIER(v8::Handle<v8::Object> target)
+template <class F, F Function> class Binder;
 
-//// Module define function
+template <class R, class... A, R (*Function)(A...)>
+class Binder<R (*)(A...), Function> {
+public:
+  static V8_SCB(Call) {
+    __v8_cb_start
+      if (info.Length() < int(sizeof...(A)))
+        V8_STHROW(RangeErr("Not enough arguments."));
+      int bad = Mismatch(info, Indices());
+      if (bad >= 0)
+        V8_STHROW(internal::ArgumentErr(bad, Expected(bad)));
+      V8_RET(Invoke(info, Indices()));
+    V8_WRAP_END()
+    __v8_implicit_return(v8::Undefined())
+  }
+private:
+  typedef typename internal::MakeIndices<sizeof...(A)>::type Indices;
+
+  template <int... I>
+  static inline int Mismatch(const __v8_arguments_type& info,
+                             internal::Indices<I...>) {
+    const bool ok [] = {true, Traits<A>::Is(info[I])...};
+    for (int i = 0; i < int(sizeof...(A)); i++)
+      if (!ok[i + 1]) return i;
+    return -1;
+  }
+  static inline const char* Expected(int index) {
+    const char* expected [] = {"", Traits<A>::Expected()...};
+    return expected[index + 1];
+  }
+  template <int... I>
+  static inline v8::Handle<v8::Value> Invoke(const __v8_arguments_type& info,
+                                             internal::Indices<I...>) {
+    return internal::BindReturn<R>::Call(Function, Traits<A>::Get(info[I])...);
+  }
 
-#define NODE_DEF_MAIN()                                                        \
-  extern "C" {                                                                 \
-    NODE_DEF(init) {                                                           \
-      V8_HANDLE_SCOPE(scope);
+  template <class T> struct Traits
+      : ArgTraits<typename std::remove_cv<typename std::remove_reference<T>::type>::type> {};
+};
 
-#define NODE_DEF_MAIN_END(MODULE) }                                            \
-    NODE_MODULE(MODULE, init); }
+/**
+ * Turns a plain C++ function into a callback, checking the arity and the
+ * type of every argument upfront (no coercion). Mismatches are thrown into
+ * JS directly, without C++ exceptions. The return value is converted back
+ * through Int(), Num(), Str()... (see ArgTraits):
+ *
+ *   int Clamp(int32_t value, int32_t min, int32_t max);
+ *   V8_DEF_CB("clamp", V8_BIND(Clamp));
+ **/
+#define V8_BIND(FUNCTION) v8u::Binder<decltype(&FUNCTION), &FUNCTION>::Call
 
-//// Type (class) define function
+namespace internal {
 
-#define NODE_SDEF_TYPE() static NODE_DEF(init)
-#define NODE_ESDEF_TYPE(TYPE)   NODE_DEF(TYPE::init)
+//// Numbers and booleans whose JS value can be taken as is
+template <class T> struct FastArg;
 
-#define NODE_DEF_TYPE(V8_NAME)                                                 \
-  inline NODE_SDEF_TYPE() {                                                    \
-    V8_HANDLE_SCOPE(scope);                                                    \
-    V8_DEF_TYPE_PRE()                                                          \
-    V8_DEF_TYPE(V8_NAME)
+#define __v8_fast_arg(TYPE, IS, GET)                                           \
+template <> struct FastArg<TYPE> {                                             \
+  static inline bool Is(v8::Handle<v8::Value> hdl) { return hdl->IS(); }       \
+  static inline TYPE Get(v8::Handle<v8::Value> hdl) { return hdl->GET(); }     \
+};
 
-#define NODE_EDEF_TYPE(TYPE, V8_NAME)                                          \
-  NODE_ESDEF_TYPE(TYPE) {                                                      \
-    V8_HANDLE_SCOPE(scope);                                                    \
-    V8_DEF_TYPE_PRE()                                                          \
-    V8_DEF_TYPE(V8_NAME)
+__v8_fast_arg(int32_t, IsInt32, Int32Value)
+__v8_fast_arg(uint32_t, IsUint32, Uint32Value)
+__v8_fast_arg(int64_t, IsNumber, IntegerValue)
+__v8_fast_arg(double, IsNumber, NumberValue)
+__v8_fast_arg(bool, IsBoolean, BooleanValue)
 
-#define NODE_DEF_TYPE_END()                                                    \
-    target->Set(__cname, templ->GetFunction());                                \
+#if NODE_VERSION_AT_LEAST(0,11,8)
+template <class R> struct FastReturn {
+  template <class F, class... A>
+  static inline void Call(const __v8_arguments_type& info, F function, A... args) {
+    info.GetReturnValue().Set(function(args...));
+  }
+};
+//// As a double, like ArgTraits<int64_t>::New
+template <> struct FastReturn<int64_t> {
+  template <class F, class... A>
+  static inline void Call(const __v8_arguments_type& info, F function, A... args) {
+    info.GetReturnValue().Set(double(function(args...)));
+  }
+};
+template <> struct FastReturn<void> {
+  template <class F, class... A>
+  static inline void Call(const __v8_arguments_type& info, F function, A... args) {
+    function(args...);
+  }
+};
+#else
+template <class R> struct FastReturn {
+  template <class F, class... A>
+  static inline v8::Handle<v8::Value> Call(const __v8_arguments_type& info,
+                                           F function, A... args) {
+    return BindReturn<R>::Call(function, args...);
   }
+};
+#endif
 
-//// V8_TYPE + NODE_DEF_TYPE = NODE_TYPE
+};
 
-#define NODE_STYPE(CPP_TYPE)                                                   \
-  V8_STYPE(CPP_TYPE);                                                          \
-  NODE_SDEF_TYPE()
+template <class F, F Function> class FastBinder;
 
-#define NODE_TYPE(CPP_TYPE, V8_NAME)                                           \
-  V8_TYPE(CPP_TYPE)                                                            \
-  inline NODE_SDEF_TYPE() {                                                    \
-    if (templ_) {                                                              \
-      target->Set(v8::String::NewSymbol(V8_NAME), v8::Handle<v8::Function>(templ_->GetFunction()));\
-      return;                                                                  \
-    }                                                                          \
-    V8_HANDLE_SCOPE(scope);                                                    \
-    V8_DEF_TYPE_PRE()                                                          \
-    V8_DEF_TYPE(V8_NAME)
+template <class R, class... A, R (*Function)(A...)>
+class FastBinder<R (*)(A...), Function> {
+public:
+  static V8_SCB(Call) {
+    if (info.Length() >= int(sizeof...(A)) && Fits(info, Indices()))
+      return Invoke(info, Indices());
+    return Binder<R (*)(A...), Function>::Call(info);
+  }
+private:
+  typedef typename internal::MakeIndices<sizeof...(A)>::type Indices;
+
+  template <int... I>
+  static inline bool Fits(const __v8_arguments_type& info,
+                          internal::Indices<I...>) {
+    const bool ok [] = {true, Traits<A>::Is(info[I])...};
+    for (int i = 0; i < int(sizeof...(A)); i++)
+      if (!ok[i + 1]) return false;
+    return true;
+  }
+  template <int... I>
+  static inline __v8_cb_return Invoke(const __v8_arguments_type& info,
+                                      internal::Indices<I...>) {
+    return internal::FastReturn<R>::Call(info, Function, Traits<A>::Get(info[I])...);
+  }
 
-#define NODE_ETYPE(TYPE, V8_NAME)                                              \
-  V8_ETYPE(TYPE)                                                               \
-  NODE_ESDEF_TYPE(TYPE) {                                                      \
-    if (templ_) {                                                              \
-      target->Set(v8::String::NewSymbol(V8_NAME), v8::Handle<v8::Function>(templ_->GetFunction()));\
-      return;                                                                  \
-    }                                                                          \
-    V8_HANDLE_SCOPE(scope);                                                    \
-    V8_DEF_TYPE_PRE()                                                          \
-    V8_DEF_TYPE(V8_NAME)
+  template <class T> struct Traits
+      : internal::FastArg<typename std::remove_cv<typename std::remove_reference<T>::type>::type> {};
+};
 
-#define NODE_TYPE_END()                                                        \
-    _templ = *templ;                                                           \
-  NODE_DEF_TYPE_END()
+/**
+ * Like V8_BIND, for functions taking and returning only numbers and
+ * booleans. When every argument already has the right type, the function
+ * is called straight away: no HandleScope, no try/catch and (on new V8s)
+ * no handle for the result. Anything else takes the V8_BIND path, which
+ * coerces nothing and throws the usual errors. The function must not
+ * throw.
+ *
+ *   double Clamp(double value, double min, double max);
+ *   V8_DEF_CB("clamp", V8_FAST_BIND(Clamp));
+ **/
+#define V8_FAST_BIND(FUNCTION) v8u::FastBinder<decltype(&FUNCTION), &FUNCTION>::Call
+
+#endif
+
+// Structs
+
+#if __cplusplus >= 201103L
+
+//// Applies M(A, X) to every X (up to 16)
+#define __v8_each(M, A, ...)                                                   \
+  __v8_concat(__v8_each_, __v8_count(__VA_ARGS__))(M, A, __VA_ARGS__)
+#define __v8_count(...) __v8_count_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define __v8_count_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define __v8_concat(A, B) __v8_concat_(A, B)
+#define __v8_concat_(A, B) A##B
+#define __v8_each_1(M, A, X) M(A, X)
+#define __v8_each_2(M, A, X, ...) M(A, X) __v8_each_1(M, A, __VA_ARGS__)
+#define __v8_each_3(M, A, X, ...) M(A, X) __v8_each_2(M, A, __VA_ARGS__)
+#define __v8_each_4(M, A, X, ...) M(A, X) __v8_each_3(M, A, __VA_ARGS__)
+#define __v8_each_5(M, A, X, ...) M(A, X) __v8_each_4(M, A, __VA_ARGS__)
+#define __v8_each_6(M, A, X, ...) M(A, X) __v8_each_5(M, A, __VA_ARGS__)
+#define __v8_each_7(M, A, X, ...) M(A, X) __v8_each_6(M, A, __VA_ARGS__)
+#define __v8_each_8(M, A, X, ...) M(A, X) __v8_each_7(M, A, __VA_ARGS__)
+#define __v8_each_9(M, A, X, ...) M(A, X) __v8_each_8(M, A, __VA_ARGS__)
+#define __v8_each_10(M, A, X, ...) M(A, X) __v8_each_9(M, A, __VA_ARGS__)
+#define __v8_each_11(M, A, X, ...) M(A, X) __v8_each_10(M, A, __VA_ARGS__)
+#define __v8_each_12(M, A, X, ...) M(A, X) __v8_each_11(M, A, __VA_ARGS__)
+#define __v8_each_13(M, A, X, ...) M(A, X) __v8_each_12(M, A, __VA_ARGS__)
+#define __v8_each_14(M, A, X, ...) M(A, X) __v8_each_13(M, A, __VA_ARGS__)
+#define __v8_each_15(M, A, X, ...) M(A, X) __v8_each_14(M, A, __VA_ARGS__)
+#define __v8_each_16(M, A, X, ...) M(A, X) __v8_each_15(M, A, __VA_ARGS__)
+
+template <class T> bool ToVector(v8::Handle<v8::Value> value, std::vector<T>& out);
+
+namespace internal {
+
+//// Holds an ObjectTemplate, one per isolate
+class ObjectTemplateSlot {
+public:
+  inline ObjectTemplateSlot() : index_(IsolateState::NewObjectIndex()) {}
+  inline v8::Local<v8::ObjectTemplate> Get() const {
+    IsolateState* state = IsolateState::Current();
+    if (index_ >= state->objects.size()) return v8::Local<v8::ObjectTemplate>();
+    return v8::Local<v8::ObjectTemplate>::New(state->objects[index_]);
+  }
+  inline void Set(v8::Handle<v8::ObjectTemplate> templ) {
+    IsolateState* state = IsolateState::Current();
+    if (index_ >= state->objects.size()) state->objects.resize(index_ + 1);
+    state->objects[index_] = v8::Persistent<v8::ObjectTemplate>::New(templ);
+  }
+private:
+  size_t index_;
+};
+
+template <class T> struct FieldTraits : ArgTraits<typename std::decay<T>::type> {};
+
+/**
+ * Conversions for V8U_STRUCT types. Field names are cached symbols, and
+ * objects come from an ObjectTemplate with every field already in place,
+ * so they all share one hidden class and filling them doesn't reshape it.
+ **/
+template <class T> struct StructTraits {
+  //// Names the field that made the last Is() on this thread fail, if any
+  static const char* Expected() {
+    static __v8_thread_local char message [128];
+    int bad = Mismatched();
+    if (bad < 0) return "an object";
+    snprintf(message, sizeof(message), "an object whose \"%s\" is %s",
+             Fields::Name(bad), Fields::FieldExpected(bad));
+    return message;
+  }
+  //// Checks every field with its own ArgTraits<>::Is(), without coercion
+  static bool Is(v8::Handle<v8::Value> hdl) {
+    Mismatched() = -1;
+    if (!hdl->IsObject()) return false;
+    V8_HANDLE_SCOPE(scope);
+    v8::Local<v8::String> names [Fields::FIELDS];
+    Names(names);
+    Mismatched() = Fields::FieldMismatch(hdl->ToObject(), names);
+    return Mismatched() < 0;
+  }
+
+  static T Get(v8::Handle<v8::Value> hdl) {
+    v8::Local<v8::String> names [Fields::FIELDS];
+    Names(names);
+    T value;
+    Fields::Read(hdl->ToObject(), value, names);
+    return value;
+  }
+  static v8::Handle<v8::Value> New(const T& value) {
+    v8::Local<v8::String> names [Fields::FIELDS];
+    Names(names);
+    v8::Local<v8::Object> obj = Template(names)->NewInstance();
+    Fields::Write(obj, value, names);
+    return obj;
+  }
+
+  //// Array of objects, names and template are looked up once
+  static v8::Local<v8::Array> NewArray(const T* items, size_t count) {
+    V8_HANDLE_SCOPE(scope);
+    v8::Local<v8::String> names [Fields::FIELDS];
+    Names(names);
+    v8::Local<v8::ObjectTemplate> templ = Template(names);
+    v8::Local<v8::Array> array = v8::Array::New(count);
+    for (size_t i = 0; i < count; i++) {
+      v8::Local<v8::Object> obj = templ->NewInstance();
+      Fields::Write(obj, items[i], names);
+      array->Set(i, obj);
+    }
+    return scope.Close(array);
+  }
+  //// Reads objects one by one, with the names looked up only once
+  class Reader {
+  public:
+    inline Reader() {
+      Names(names_);
+    }
+    //// Same as StructTraits::Is(), without recording the field
+    inline bool Is(v8::Handle<v8::Value> hdl) const {
+      return hdl->IsObject() &&
+             ArgTraits<T>::FieldMismatch(hdl->ToObject(), names_) < 0;
+    }
+    //// Only after Is() returned true
+    inline T Get(v8::Handle<v8::Value> hdl) const {
+      T value;
+      ArgTraits<T>::Read(hdl->ToObject(), value, names_);
+      return value;
+    }
+  private:
+    v8::Local<v8::String> names_ [ArgTraits<T>::FIELDS];
+  };
+  //// Same as ToVector<T>(): false, with items untouched, if one isn't a T
+  static inline bool GetArray(v8::Handle<v8::Array> array, std::vector<T>& items) {
+    return ToVector(array, items);
+  }
+private:
+  typedef ArgTraits<T> Fields;
+
+  static inline int& Mismatched() {
+    static __v8_thread_local int index = -1;
+    return index;
+  }
+  static inline void Names(v8::Local<v8::String>* names) {
+    static SymbolSlot slots [Fields::FIELDS];
+    for (int i = 0; i < Fields::FIELDS; i++)
+      names[i] = slots[i].Get(Fields::Name(i), -1);
+  }
+  static v8::Local<v8::ObjectTemplate> Template(const v8::Local<v8::String>* names) {
+    static ObjectTemplateSlot slot;
+    v8::Local<v8::ObjectTemplate> templ = slot.Get();
+    if (!templ.IsEmpty()) return templ;
+    templ = v8::ObjectTemplate::New();
+    for (int i = 0; i < Fields::FIELDS; i++)
+      templ->Set(names[i], v8::Undefined());
+    slot.Set(templ);
+    return templ;
+  }
+};
+
+};
+
+#define __v8_struct_name(TYPE, FIELD) #FIELD,
+#define __v8_struct_read(TYPE, FIELD)                                          \
+  value.FIELD = internal::FieldTraits<decltype(value.FIELD)>::Get(obj->Get(names[i++]));
+#define __v8_struct_write(TYPE, FIELD)                                         \
+  obj->Set(names[i++], internal::FieldTraits<decltype(value.FIELD)>::New(value.FIELD));
+#define __v8_struct_expected(TYPE, FIELD)                                      \
+  internal::FieldTraits<decltype(TYPE::FIELD)>::Expected(),
+#define __v8_struct_check(TYPE, FIELD)                                         \
+  if (!internal::FieldTraits<decltype(TYPE::FIELD)>::Is(obj->Get(names[i])))   \
+    return i;                                                                  \
+  i++;
+
+/**
+ * Lets TYPE (default-constructible, with the listed public fields) go back
+ * and forth between C++ and JS objects, through ArgTraits, so V8_BIND and
+ * friends take it and return it. Use it at global scope:
+ *
+ *   struct Point { int32_t x, y; std::string label; };
+ *   V8U_STRUCT(Point, x, y, label)
+ *
+ *   V8_RET(v8u::ArgTraits<Point>::New(point));
+ *   V8_RET(v8u::ArgTraits<Point>::NewArray(points.data(), points.size()));
+ **/
+#define V8U_STRUCT(TYPE, ...)                                                  \
+namespace v8u {                                                                \
+template <> struct ArgTraits<TYPE> : internal::StructTraits<TYPE> {            \
+  enum { FIELDS = __v8_count(__VA_ARGS__) };                                   \
+  static inline const char* Name(int index) {                                  \
+    static const char* const names [] = {                                      \
+      __v8_each(__v8_struct_name, TYPE, __VA_ARGS__)                           \
+    };                                                                         \
+    return names[index];                                                       \
+  }                                                                            \
+  static inline const char* FieldExpected(int index) {                         \
+    const char* const expected [] = {                                          \
+      __v8_each(__v8_struct_expected, TYPE, __VA_ARGS__)                       \
+    };                                                                         \
+    return expected[index];                                                    \
+  }                                                                            \
+  static inline int FieldMismatch(v8::Handle<v8::Object> obj,                  \
+                                  const v8::Local<v8::String>* names) {        \
+    int i = 0;                                                                 \
+    __v8_each(__v8_struct_check, TYPE, __VA_ARGS__)                            \
+    return -1;                                                                 \
+  }                                                                            \
+  static inline void Read(v8::Handle<v8::Object> obj, TYPE& value,             \
+                          const v8::Local<v8::String>* names) {                \
+    int i = 0;                                                                 \
+    __v8_each(__v8_struct_read, TYPE, __VA_ARGS__)                             \
+  }                                                                            \
+  static inline void Write(v8::Handle<v8::Object> obj, const TYPE& value,      \
+                           const v8::Local<v8::String>* names) {               \
+    int i = 0;                                                                 \
+    __v8_each(__v8_struct_write, TYPE, __VA_ARGS__)                            \
+  }                                                                            \
+};                                                                             \
+}
+
+#endif
+
+// Arrays and vectors
+
+//// Elements converted per inner handle scope when reading arrays
+#ifndef V8U_ARRAY_CHUNK
+  #define V8U_ARRAY_CHUNK 1024
+#endif
+
+#if __cplusplus >= 201103L
+
+namespace internal {
+
+template <class T, class E>
+inline void CopyElements(const E* data, size_t length, std::vector<T>& out) {
+  out.resize(length);
+  for (size_t i = 0; i < length; i++) out[i] = static_cast<T>(data[i]);
+}
+template <class E>
+inline void CopyElements(const E* data, size_t length, std::vector<E>& out) {
+  out.resize(length);
+  if (length) std::memcpy(&out[0], data, length * sizeof(E));
+}
+
+//// Typed arrays (and Buffers) of any element type, for numeric T
+template <class T>
+bool CopyExternal(v8::Handle<v8::Object> obj, std::vector<T>& out, std::true_type) {
+  if (!obj->HasIndexedPropertiesInExternalArrayData()) return false;
+  void* data = obj->GetIndexedPropertiesExternalArrayData();
+  size_t length = obj->GetIndexedPropertiesExternalArrayDataLength();
+  switch (obj->GetIndexedPropertiesExternalArrayDataType()) {
+    case v8::kExternalByteArray:
+      CopyElements(static_cast<int8_t*>(data), length, out); break;
+    case v8::kExternalUnsignedByteArray:
+    case v8::kExternalPixelArray:
+      CopyElements(static_cast<uint8_t*>(data), length, out); break;
+    case v8::kExternalShortArray:
+      CopyElements(static_cast<int16_t*>(data), length, out); break;
+    case v8::kExternalUnsignedShortArray:
+      CopyElements(static_cast<uint16_t*>(data), length, out); break;
+    case v8::kExternalIntArray:
+      CopyElements(static_cast<int32_t*>(data), length, out); break;
+    case v8::kExternalUnsignedIntArray:
+      CopyElements(static_cast<uint32_t*>(data), length, out); break;
+    case v8::kExternalFloatArray:
+      CopyElements(static_cast<float*>(data), length, out); break;
+    case v8::kExternalDoubleArray:
+      CopyElements(static_cast<double*>(data), length, out); break;
+    default:
+      return false;
+  }
+  return true;
+}
+template <class T>
+inline bool CopyExternal(v8::Handle<v8::Object> obj, std::vector<T>& out, std::false_type) {
+  return false;
+}
+
+template <class T, bool> struct ElementReader {
+  inline bool Is(v8::Handle<v8::Value> hdl) const {
+    return ArgTraits<T>::Is(hdl);
+  }
+  inline T Get(v8::Handle<v8::Value> hdl) const {
+    return ArgTraits<T>::Get(hdl);
+  }
+};
+template <class T> struct ElementReader<T, true> : ArgTraits<T>::Reader {};
+
+template <class T> struct IsStruct
+    : std::is_base_of<StructTraits<T>, ArgTraits<T> > {};
+
+template <class T>
+v8::Local<v8::Array> FromVector(const std::vector<T>& items, std::false_type) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Local<v8::Array> array = v8::Array::New(items.size());
+  for (size_t i = 0; i < items.size(); i++)
+    array->Set(i, ArgTraits<T>::New(items[i]));
+  return scope.Close(array);
+}
+template <class T>
+inline v8::Local<v8::Array> FromVector(const std::vector<T>& items, std::true_type) {
+  return ArgTraits<T>::NewArray(items.data(), items.size());
+}
+
+};
+
+/**
+ * Reads a JS array into `out`, converting every element through
+ * ArgTraits<T>::Get (numbers, bools, strings, V8U_STRUCTs...). For numeric
+ * T, typed arrays and Buffers are copied straight from their memory
+ * (memcpy when the element type matches). JS arrays go through Get(i),
+ * the only element access these V8s have: handles are released every
+ * V8U_ARRAY_CHUNK elements, and V8U_STRUCT field names are looked up once.
+ * Every element is checked with ArgTraits<T>::Is() first, like arguments.
+ * Returns false if the value is neither, or an element has the wrong type.
+ * `out` is only replaced once every element was converted, so it's left
+ * untouched on failure (or if a conversion throws).
+ **/
+template <class T> bool ToVector(v8::Handle<v8::Value> value, std::vector<T>& out) {
+#if __cplusplus >= 201703L
+  static_assert(!std::is_same<T, std::string_view>::value,
+                "views would outlive their Utf8 buffers, use std::string");
+#endif
+  if (value.IsEmpty() || !value->IsObject()) return false;
+  v8::Handle<v8::Object> obj = Obj(value);
+  if (internal::CopyExternal(obj, out, std::is_arithmetic<T>())) return true;
+  if (!value->IsArray()) return false;
+
+  v8::Handle<v8::Array> array = Arr(value);
+  uint32_t length = array->Length();
+  std::vector<T> items (length);
+  internal::ElementReader<T, internal::IsStruct<T>::value> reader;
+  for (uint32_t start = 0; start < length; start += V8U_ARRAY_CHUNK) {
+    V8_HANDLE_SCOPE(scope);
+    uint32_t end = std::min<uint32_t>(length, start + V8U_ARRAY_CHUNK);
+    for (uint32_t i = start; i < end; i++) {
+      v8::Local<v8::Value> item = array->Get(i);
+      if (item.IsEmpty() || !reader.Is(item)) return false;
+      items[i] = reader.Get(item);
+    }
+  }
+  out.swap(items);
+  return true;
+}
+
+template <class T> inline std::vector<T> ToVector(v8::Handle<v8::Value> value) {
+  std::vector<T> out;
+  ToVector(value, out);
+  return out;
+}
+
+//// Preallocated JS array with every item converted through ArgTraits<T>::New
+template <class T> inline v8::Local<v8::Array> FromVector(const std::vector<T>& items) {
+  return internal::FromVector(items, internal::IsStruct<T>());
+}
+
+#endif
+
+// Binary data (Buffers, typed arrays, array buffers)
+
+namespace internal {
+
+template <class T> struct ViewType;
+
+#define __v8_view_type(TYPE, CHECK)                                            \
+template <> struct ViewType<TYPE> {                                            \
+  static inline bool Is(v8::ExternalArrayType type) { return CHECK; }          \
+};
+
+__v8_view_type(int8_t, type == v8::kExternalByteArray)
+__v8_view_type(uint8_t, type == v8::kExternalUnsignedByteArray ||
+                        type == v8::kExternalPixelArray)
+__v8_view_type(char, type == v8::kExternalByteArray ||
+                     type == v8::kExternalUnsignedByteArray ||
+                     type == v8::kExternalPixelArray)
+__v8_view_type(int16_t, type == v8::kExternalShortArray)
+__v8_view_type(uint16_t, type == v8::kExternalUnsignedShortArray)
+__v8_view_type(int32_t, type == v8::kExternalIntArray)
+__v8_view_type(uint32_t, type == v8::kExternalUnsignedIntArray)
+__v8_view_type(float, type == v8::kExternalFloatArray)
+__v8_view_type(double, type == v8::kExternalDoubleArray)
+
+inline size_t ElementSize(v8::ExternalArrayType type) {
+  switch (type) {
+    case v8::kExternalShortArray:
+    case v8::kExternalUnsignedShortArray:
+      return 2;
+    case v8::kExternalIntArray:
+    case v8::kExternalUnsignedIntArray:
+    case v8::kExternalFloatArray:
+      return 4;
+    case v8::kExternalDoubleArray:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+template <class C> void ReleaseOwner(char* data, void* hint) {
+  delete static_cast<C*>(hint);
+}
+
+};
+
+/**
+ * Borrowed (zero-copy) view over the elements of a typed array, i.e.
+ * View<double> for a Float64Array. View<uint8_t> and View<char> also take
+ * Buffers. The data belongs to the JS object, so keep it alive while the
+ * view is in use. IsEmpty() if the value wasn't of the right type.
+ **/
+template <class T> class View {
+public:
+  inline View() : data_(NULL), length_(0), valid_(false) {}
+  inline View(v8::Handle<v8::Value> value)
+      : data_(NULL), length_(0), valid_(false) {
+    if (!value->IsObject()) return;
+    v8::Handle<v8::Object> obj = Obj(value);
+    if (!obj->HasIndexedPropertiesInExternalArrayData()) return;
+    if (!internal::ViewType<T>::Is(obj->GetIndexedPropertiesExternalArrayDataType()))
+      return;
+    data_ = static_cast<T*>(obj->GetIndexedPropertiesExternalArrayData());
+    length_ = obj->GetIndexedPropertiesExternalArrayDataLength();
+    valid_ = true;
+  }
+  inline bool IsEmpty() const {
+    return !valid_;
+  }
+  inline T* data() const {
+    return data_;
+  }
+  inline size_t length() const {
+    return length_;
+  }
+  inline T& operator[](size_t index) const {
+    return data_[index];
+  }
+  inline T* begin() const {
+    return data_;
+  }
+  inline T* end() const {
+    return data_ + length_;
+  }
+private:
+  T* data_;
+  size_t length_;
+  bool valid_;
+};
+
+/**
+ * Borrowed (zero-copy) view over the raw bytes of a Buffer, any typed array
+ * or an ArrayBuffer. Same lifetime rules as View.
+ *
+ * Bytes::New() goes the other way: it wraps memory owned by C++ in a Buffer
+ * without copying, and calls RELEASE(data, hint) once the Buffer is collected
+ * so the owner gets it back.
+ **/
+class Bytes {
+public:
+  inline Bytes() : data_(NULL), length_(0), valid_(false) {}
+  inline Bytes(v8::Handle<v8::Value> value)
+      : data_(NULL), length_(0), valid_(false) {
+#if NODE_VERSION_AT_LEAST(0,12,0)
+    if (value->IsArrayBufferView()) {
+      v8::ArrayBufferView* view = v8::ArrayBufferView::Cast(*value);
+      v8::ArrayBuffer::Contents contents = view->Buffer()->GetContents();
+      Set(static_cast<char*>(contents.Data()) + view->ByteOffset(),
+          view->ByteLength());
+      return;
+    }
+    if (value->IsArrayBuffer()) {
+      v8::ArrayBuffer::Contents contents =
+          v8::ArrayBuffer::Cast(*value)->GetContents();
+      Set(static_cast<char*>(contents.Data()), contents.ByteLength());
+      return;
+    }
+#endif
+    if (!value->IsObject()) return;
+    v8::Handle<v8::Object> obj = Obj(value);
+    if (!obj->HasIndexedPropertiesInExternalArrayData()) return;
+    Set(static_cast<char*>(obj->GetIndexedPropertiesExternalArrayData()),
+        obj->GetIndexedPropertiesExternalArrayDataLength() *
+        internal::ElementSize(obj->GetIndexedPropertiesExternalArrayDataType()));
+  }
+  inline bool IsEmpty() const {
+    return !valid_;
+  }
+  inline char* data() const {
+    return data_;
+  }
+  inline size_t length() const {
+    return length_;
+  }
+  inline std::string str() const {
+    return std::string(data_, length_);
+  }
+
+  static inline v8::Local<v8::Object> New(char* data, size_t length,
+      node::Buffer::free_callback release, void* hint = NULL) {
+#if NODE_VERSION_AT_LEAST(0,11,3)
+    return node::Buffer::New(data, length, release, hint);
+#else
+    return v8::Local<v8::Object>::New(
+        node::Buffer::New(data, length, release, hint)->handle_);
+#endif
+  }
+  //// Takes a heap-allocated container (std::string, std::vector...) and
+  //// deletes it when the Buffer is collected
+  template <class C> static inline v8::Local<v8::Object> New(C* owner) {
+    return New(reinterpret_cast<char*>(const_cast<typename C::value_type*>(owner->data())),
+               owner->size() * sizeof(typename C::value_type),
+               internal::ReleaseOwner<C>, owner);
+  }
+private:
+  inline void Set(char* data, size_t length) {
+    data_ = data;
+    length_ = length;
+    valid_ = true;
+  }
+
+  char* data_;
+  size_t length_;
+  bool valid_;
+};
+
+#if __cplusplus >= 201103L
+template <> struct ArgTraits<Bytes> {
+  static inline const char* Expected() { return "a Buffer or typed array"; }
+  static inline bool Is(v8::Handle<v8::Value> hdl) { return !Bytes(hdl).IsEmpty(); }
+  static inline Bytes Get(v8::Handle<v8::Value> hdl) { return Bytes(hdl); }
+};
+template <class T> struct ArgTraits<View<T> > {
+  static inline const char* Expected() { return "a typed array"; }
+  static inline bool Is(v8::Handle<v8::Value> hdl) { return !View<T>(hdl).IsEmpty(); }
+  static inline View<T> Get(v8::Handle<v8::Value> hdl) { return View<T>(hdl); }
+};
+#endif
+
+// External (zero-copy) strings
+
+//// Below this many characters, external strings don't pay off
+#ifndef V8U_EXTERNAL_STR_MIN
+  #define V8U_EXTERNAL_STR_MIN (64 * 1024)
+#endif
+
+namespace internal {
+
+inline bool IsAscii(const char* data, size_t length) {
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    if (word & 0x8080808080808080ULL) return false;
+  }
+  for (; i < length; i++)
+    if (data[i] & 0x80) return false;
+  return true;
+}
+
+//// UTF-8 to UTF-16, invalid sequences become U+FFFD
+inline void DecodeUtf8(const char* data, size_t length, std::vector<uint16_t>& out) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  const unsigned char* end = p + length;
+  out.reserve(length);
+  while (p < end) {
+    uint32_t c = *p++;
+    if (c < 0x80) {
+      out.push_back(c);
+      continue;
+    }
+    int extra = c < 0xC2 ? -1 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF5 ? 3 : -1;
+    if (extra < 0) {
+      out.push_back(0xFFFD);
+      continue;
+    }
+    // Narrower second byte ranges rule out overlong forms (E0, F0),
+    // surrogates (ED) and code points past U+10FFFF (F4)
+    unsigned char low = c == 0xE0 ? 0xA0 : c == 0xF0 ? 0x90 : 0x80;
+    unsigned char high = c == 0xED ? 0x9F : c == 0xF4 ? 0x8F : 0xBF;
+    c &= 0x3F >> extra;
+    int i = 0;
+    for (; i < extra && p + i < end; i++) {
+      unsigned char byte = p[i];
+      if (i ? (byte & 0xC0) != 0x80 : byte < low || byte > high) break;
+      c = (c << 6) | (byte & 0x3F);
+    }
+    // A broken sequence is one U+FFFD, up to the first byte that didn't fit
+    p += i;
+    if (i < extra) {
+      out.push_back(0xFFFD);
+      continue;
+    }
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      out.push_back(0xD800 | (c >> 10));
+      out.push_back(0xDC00 | (c & 0x3FF));
+    } else {
+      out.push_back(c);
+    }
+  }
+}
+
+template <class Base, class Char> class ExternalResource : public Base {
+public:
+  inline ExternalResource(const Char* data, size_t length)
+      : data_(data), length_(length) {}
+  virtual const Char* data() const {
+    return data_;
+  }
+  virtual size_t length() const {
+    return length_;
+  }
+protected:
+  const Char* data_;
+  size_t length_;
+};
+
+//// Steals the contents of a std::string / std::vector, and reports them to V8
+template <class Base, class Char, class Storage>
+class OwnedExternalResource : public ExternalResource<Base, Char> {
+public:
+  inline OwnedExternalResource(Storage& storage)
+      : ExternalResource<Base, Char>(NULL, 0) {
+    storage_.swap(storage);
+    this->data_ = storage_.empty() ? NULL : &storage_[0];
+    this->length_ = storage_.size();
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(Size());
+  }
+  virtual ~OwnedExternalResource() {
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(-Size());
+  }
+private:
+  inline intptr_t Size() const {
+    return static_cast<intptr_t>(storage_.size() * sizeof(Char));
+  }
+
+  Storage storage_;
+};
+
+typedef v8::String::ExternalAsciiStringResource OneByteResource;
+typedef v8::String::ExternalStringResource TwoByteResource;
+
+};
+
+/**
+ * Strings backed by memory outside of the V8 heap: nothing gets copied into
+ * the heap, nor moved around by the GC. Meant for big generated results.
+ * Strings shorter than V8U_EXTERNAL_STR_MIN are just copied, like Str().
+ *
+ * UTF-8 data is scanned once: if it's all ASCII it's used as is (one-byte),
+ * otherwise it's decoded into a two-byte buffer owned by the string.
+ **/
+
+//// Borrows DATA, which must stay valid (and unchanged) forever
+inline v8::Local<v8::String> ExternalStr(const char* data, size_t length) {
+  if (length < V8U_EXTERNAL_STR_MIN) return Str(data, length);
+  if (internal::IsAscii(data, length))
+    return v8::String::NewExternal(new internal::ExternalResource<
+        internal::OneByteResource, char>(data, length));
+  std::vector<uint16_t> decoded;
+  internal::DecodeUtf8(data, length, decoded);
+  return v8::String::NewExternal(new internal::OwnedExternalResource<
+      internal::TwoByteResource, uint16_t, std::vector<uint16_t> >(decoded));
+}
+
+//// Takes the contents of STR (which is left empty)
+inline v8::Local<v8::String> ExternalStr(std::string& str) {
+  v8::Local<v8::String> ret;
+  if (str.size() < V8U_EXTERNAL_STR_MIN) {
+    ret = Str(str);
+  } else if (internal::IsAscii(str.data(), str.size())) {
+    return v8::String::NewExternal(new internal::OwnedExternalResource<
+        internal::OneByteResource, char, std::string>(str));
+  } else {
+    ret = ExternalStr(str.data(), str.size());
+  }
+  str.clear();
+  return ret;
+}
+
+//// Borrows UTF-16 DATA, which must stay valid (and unchanged) forever
+inline v8::Local<v8::String> ExternalStr(const uint16_t* data, size_t length) {
+  if (length < V8U_EXTERNAL_STR_MIN) return v8::String::New(data, length);
+  return v8::String::NewExternal(new internal::ExternalResource<
+      internal::TwoByteResource, uint16_t>(data, length));
+}
+
+//// Takes the contents of UTF-16 STR (which is left empty)
+inline v8::Local<v8::String> ExternalStr(std::vector<uint16_t>& str) {
+  if (str.size() < V8U_EXTERNAL_STR_MIN) {
+    v8::Local<v8::String> ret = v8::String::New(str.empty() ? NULL : &str[0], str.size());
+    str.clear();
+    return ret;
+  }
+  return v8::String::NewExternal(new internal::OwnedExternalResource<
+      internal::TwoByteResource, uint16_t, std::vector<uint16_t> >(str));
+}
+
+// Reading strings (the other way round)
+
+//// Strings up to this many UTF-8 bytes are read without allocating
+#ifndef V8U_INLINE_STR
+  #define V8U_INLINE_STR 256
+#endif
+
+//// Biggest spilled buffer that's kept around for reuse (per thread)
+#ifndef V8U_SPARE_STR
+  #define V8U_SPARE_STR (1024 * 1024)
+#endif
+
+namespace internal {
+
+struct SpareBuffer {
+  char* data;
+  size_t size;
+};
+
+inline SpareBuffer& Spare() {
+  static __v8_thread_local SpareBuffer spare = {NULL, 0};
+  return spare;
+}
+
+};
+
+/**
+ * UTF-8 contents of a JS value, like v8::String::Utf8Value but without
+ * allocating for short strings: up to V8U_INLINE_STR bytes are written
+ * into inline storage (ASCII strings with a plain one-byte copy when
+ * possible). Longer ones spill into a buffer that is recycled per thread.
+ * Always null-terminated.
+ **/
+class Utf8 {
+public:
+  inline explicit Utf8(v8::Handle<v8::Value> value)
+      : data_(inline_), length_(0), capacity_(0) {
+    inline_[0] = 0;
+    if (value.IsEmpty()) return;
+    v8::Local<v8::String> str = value->ToString();
+    if (str.IsEmpty()) return;
+    int length = str->Length();
+    int options = v8::String::NO_NULL_TERMINATION;
+
+#if NODE_VERSION_AT_LEAST(0,11,0)
+    if (length < V8U_INLINE_STR && str->IsOneByte()) {
+      str->WriteOneByte(reinterpret_cast<uint8_t*>(inline_), 0, length, options);
+      if (internal::IsAscii(inline_, length)) {
+        Terminate(length);
+        return;
+      }
+    }
+#endif
+    // One UTF-16 unit takes at most 3 UTF-8 bytes
+    int size = length * 3 < V8U_INLINE_STR ? length * 3 : str->Utf8Length();
+    if (size >= V8U_INLINE_STR) Spill(size + 1);
+    Terminate(str->WriteUtf8(data_, size, NULL, options));
+  }
+  inline ~Utf8() {
+    if (data_ == inline_) return;
+    internal::SpareBuffer& spare = internal::Spare();
+    if (!spare.data && capacity_ <= V8U_SPARE_STR) {
+      spare.data = data_;
+      spare.size = capacity_;
+    } else {
+      delete[] data_;
+    }
+  }
+
+  inline const char* operator*() const {
+    return data_;
+  }
+  inline const char* data() const {
+    return data_;
+  }
+  inline size_t length() const {
+    return length_;
+  }
+  inline std::string str() const {
+    return std::string(data_, length_);
+  }
+#if __cplusplus >= 201703L
+  inline operator std::string_view() const {
+    return std::string_view(data_, length_);
+  }
+#endif
+private:
+  Utf8(const Utf8&);
+  Utf8& operator=(const Utf8&);
+
+  inline void Spill(size_t size) {
+    internal::SpareBuffer& spare = internal::Spare();
+    if (spare.data && spare.size >= size) {
+      data_ = spare.data;
+      capacity_ = spare.size;
+      spare.data = NULL;
+    } else {
+      data_ = new char[size];
+      capacity_ = size;
+    }
+  }
+  inline void Terminate(size_t length) {
+    length_ = length;
+    data_[length] = 0;
+  }
+
+  char* data_;
+  size_t length_;
+  size_t capacity_;
+  char inline_ [V8U_INLINE_STR];
+};
+
+#if __cplusplus >= 201103L
+//// Goes through Utf8, so short strings take no allocation besides the copy
+__v8_arg_traits(std::string, "a string", IsString, Utf8(hdl).str(), Str(value))
+#endif
+
+#if __cplusplus >= 201703L
+//// The view is valid until the end of the call
+template <> struct ArgTraits<std::string_view> {
+  static inline const char* Expected() { return "a string"; }
+  static inline bool Is(v8::Handle<v8::Value> hdl) { return hdl->IsString(); }
+  static inline Utf8 Get(v8::Handle<v8::Value> hdl) { return Utf8(hdl); }
+  static inline v8::Handle<v8::Value> New(std::string_view value) {
+    return Str(value.data(), value.size());
+  }
+};
+#endif
+
+// Promises
+
+#if NODE_VERSION_AT_LEAST(0,11,13) && __cplusplus >= 201103L
+  #define __v8_promises
+#endif
+
+#ifdef __v8_promises
+
+/**
+ * Move-only token that settles one promise. Can be moved into a baton and
+ * settled later on the JS thread (i.e. from a libuv completion); only the
+ * first Resolve() / Reject() has effect. It doesn't run the promise
+ * reactions: AsyncWork does that after settling, other callers outside of a
+ * JS call have to drain the microtask queue themselves.
+ **/
+class Deferred {
+public:
+  inline Deferred() : resolver_(NULL) {}
+  inline explicit Deferred(v8::Isolate* isolate)
+      : resolver_(new v8::Persistent<v8::Promise::Resolver>(
+            isolate, v8::Promise::Resolver::New(isolate))) {}
+  //// The global handle lives on the heap, so moving just hands the pointer
+  inline Deferred(Deferred&& other) noexcept : resolver_(other.resolver_) {
+    other.resolver_ = NULL;
+  }
+  inline Deferred& operator=(Deferred&& other) noexcept {
+    if (&other == this) return *this;
+    Settled();
+    resolver_ = other.resolver_;
+    other.resolver_ = NULL;
+    return *this;
+  }
+  Deferred(const Deferred&) = delete;
+  Deferred& operator=(const Deferred&) = delete;
+  inline ~Deferred() {
+    Settled();
+  }
+
+  inline v8::Local<v8::Promise::Resolver> Resolver() const {
+    return v8::Local<v8::Promise::Resolver>::New(__node_isolate, *resolver_);
+  }
+  inline v8::Local<v8::Promise> Promise() const {
+    return Resolver()->GetPromise();
+  }
+  inline bool IsSettled() const {
+    return resolver_ == NULL;
+  }
+  inline void Resolve(v8::Handle<v8::Value> value) {
+    if (resolver_ == NULL) return;
+    Resolver()->Resolve(value);
+    Settled();
+  }
+  //// Use with Err(), TypeErr(), RangeErr()... like you would with V8_THROW
+  inline void Reject(v8::Handle<v8::Value> reason) {
+    if (resolver_ == NULL) return;
+    Resolver()->Reject(reason);
+    Settled();
+  }
+private:
+  inline void Settled() {
+    if (resolver_ == NULL) return;
+    resolver_->Reset();
+    delete resolver_;
+    resolver_ = NULL;
+  }
+
+  v8::Persistent<v8::Promise::Resolver>* resolver_;
+};
+
+//// Goes through the original resolver, `deferred` may have been moved out
+#define __v8_promise_reject(VALUE) __v8_resolver->Reject(VALUE)
+
+namespace internal {
+
+/**
+ * Returns the promise on every way out of a V8_PROMISE_CB, and rejects it
+ * with whatever got scheduled as the JS exception on the way (V8_FAIL, a
+ * V8_CHECK'd helper without C++ exceptions, or JS code called from it).
+ **/
+class PromiseScope {
+public:
+  inline PromiseScope(const __v8_arguments_type& info,
+                      v8::Local<v8::Promise::Resolver> resolver)
+      : info_(info), resolver_(resolver) {}
+  inline ~PromiseScope() {
+    if (try_catch_.HasCaught()) {
+      resolver_->Reject(try_catch_.Exception());
+      try_catch_.Reset();
+    }
+    info_.GetReturnValue().Set(resolver_->GetPromise());
+  }
+private:
+  const __v8_arguments_type& info_;
+  v8::Local<v8::Promise::Resolver> resolver_;
+  v8::TryCatch try_catch_;
+};
+
+};
+
+/**
+ * Like V8_CB, but the callback returns a promise. Settle it through the
+ * `deferred` token, either right away or by moving it somewhere else.
+ * Anything thrown inside, V8_FAIL and V8_CHECK reject the promise instead.
+ **/
+#define V8_PROMISE_CB(IDENTIFIER)                                              \
+V8_SCB(IDENTIFIER) {                                                           \
+  __v8_returns(__v8_cb_return)                                                 \
+  __v8_stats_hook                                                              \
+  V8_HANDLE_SCOPE(scope);                                                      \
+  v8u::Deferred deferred (__node_isolate);                                     \
+  v8::Local<v8::Promise::Resolver> __v8_resolver = deferred.Resolver();        \
+  v8u::internal::PromiseScope __v8_promise_scope (info, __v8_resolver);        \
+  __v8_try
+
+#define V8_PROMISE_CB_END()                                                    \
+  __v8_catch(__v8_promise_reject)                                              \
+}
+
+#endif
+
+// Asynchronous callbacks (work runs on the libuv threadpool)
+
+#if NODE_VERSION_AT_LEAST(0,9,4)
+  #define __uv_after_work(IDENTIFIER) void IDENTIFIER(uv_work_t* req, int status)
+#else
+  #define __uv_after_work(IDENTIFIER) void IDENTIFIER(uv_work_t* req)
+#endif
+
+#define __v8_async_error(VALUE) error = v8::Local<v8::Value>::New(VALUE)
+
+template <class T> class AsyncWork {
+public:
+  typedef void (*ExecuteCallback)(T* baton);
+  typedef v8::Handle<v8::Value> (*CompleteCallback)(T* baton);
+
+  inline AsyncWork() : execute_(NULL), complete_(NULL), failed_(false) {
+    req_.data = this;
+  }
+  inline AsyncWork(v8::Handle<v8::Function> callback)
+      : callback_(callback), execute_(NULL), complete_(NULL), failed_(false) {
+    req_.data = this;
+  }
+#ifdef __v8_promises
+  inline void SetDeferred(Deferred&& deferred) {
+    deferred_ = std::move(deferred);
+  }
+#endif
+  inline T* baton() {
+    return &baton_;
+  }
+  inline void Queue(ExecuteCallback execute, CompleteCallback complete) {
+    execute_ = execute;
+    complete_ = complete;
+    uv_queue_work(uv_default_loop(), &req_, Execute, AfterExecute);
+  }
+private:
+  // Worker thread: no V8 calls allowed here, so V8_THROW can't be used.
+  // Whatever gets thrown is stored and rethrown on the JS thread instead.
+  static void Execute(uv_work_t* req) {
+    AsyncWork<T>* work = static_cast<AsyncWork<T>*>(req->data);
+#ifdef V8U_NO_EXCEPTIONS
+    work->execute_(&work->baton_);
+#else
+    try {
+      work->execute_(&work->baton_);
+    } catch (std::exception& err) {
+      work->Fail(err.what());
+    } catch (std::string& err) {
+      work->Fail(err);
+    } catch (...) {
+      work->Fail("Unknown error!");
+    }
+#endif
+  }
+  static __uv_after_work(AfterExecute) {
+    AsyncWork<T>* work = static_cast<AsyncWork<T>*>(req->data);
+    work->Complete();
+    delete work;
+  }
+  inline void Fail(const std::string& message) {
+    error_ = message;
+    failed_ = true;
+  }
+  void Complete() {
+    V8_HANDLE_SCOPE(scope);
+    v8::Handle<v8::Value> error, result;
+#ifdef V8U_NO_EXCEPTIONS
+    result = complete_(&baton_);
+#else
+    try {
+      if (failed_) throw error_;
+      result = complete_(&baton_);
+    __v8_catch(__v8_async_error)
+#endif
+
+#ifdef __v8_promises
+    if (callback_.IsEmpty()) {
+      if (error.IsEmpty()) deferred_.Resolve(result);
+      else deferred_.Reject(error);
+      // We're outside of any JS call, so nobody else would run the reactions
+      v8::V8::RunMicrotasks(__node_isolate);
+      return;
+    }
+#endif
+    v8::Handle<v8::Value> argv [2];
+    if (error.IsEmpty()) {
+      argv[0] = v8::Null();
+      argv[1] = result;
+    } else {
+      argv[0] = error;
+      argv[1] = v8::Undefined();
+    }
+    node::MakeCallback(v8::Context::GetCurrent()->Global(), *callback_, 2, argv);
+  }
+
+  uv_work_t req_;
+  T baton_;
+  Persisted<v8::Function> callback_;
+#ifdef __v8_promises
+  Deferred deferred_;
+#endif
+  ExecuteCallback execute_;
+  CompleteCallback complete_;
+  bool failed_;
+  std::string error_;
+};
+
+//// Owns the work until it's queued, so a throwing capture phase doesn't leak
+template <class T> class AsyncCall {
+public:
+  inline AsyncCall(const __v8_arguments_type& info) : work_(NULL) {
+    int last = info.Length() - 1;
+    if (last >= 0 && info[last]->IsFunction())
+      work_ = new AsyncWork<T>(Func(info[last]));
+  }
+#ifdef __v8_promises
+  inline AsyncCall(Deferred& deferred)
+      : work_(new AsyncWork<T>()), deferred_(&deferred) {}
+#endif
+  inline ~AsyncCall() {
+    delete work_;
+  }
+  inline bool IsEmpty() const {
+    return work_ == NULL;
+  }
+  inline T* baton() {
+    return work_->baton();
+  }
+  inline void Queue(typename AsyncWork<T>::ExecuteCallback execute,
+                    typename AsyncWork<T>::CompleteCallback complete) {
+#ifdef __v8_promises
+    if (deferred_) work_->SetDeferred(std::move(*deferred_));
+#endif
+    work_->Queue(execute, complete);
+    work_ = NULL;
+  }
+private:
+  AsyncWork<T>* work_;
+#ifdef __v8_promises
+  Deferred* deferred_ = NULL;
+#endif
+};
+
+/**
+ * Splits a callback in three phases, each one with access to a BATON*
+ * called `baton` (BATON must be default-constructible):
+ *
+ *   static V8_ASYNC_CB(Hash, HashBaton) {
+ *     baton->input = ...;          // JS thread: capture the arguments
+ *   } V8_ASYNC_EXECUTE() {
+ *     baton->output = ...;         // threadpool: no V8 here, throw std::*
+ *   } V8_ASYNC_COMPLETE() {
+ *     return Str(baton->output);   // JS thread: value for the callback
+ *   } V8_ASYNC_END()
+ *
+ * The last JS argument is the Node-style callback. Exceptions from any phase
+ * are mapped like V8_WRAP_END does; the ones from the capture phase are thrown
+ * synchronously, the others are passed as the first callback argument.
+ **/
+#define V8_ASYNC_CB(IDENTIFIER, BATON)                                         \
+V8_CB(IDENTIFIER)                                                              \
+  typedef BATON __v8_baton_type;                                               \
+  v8u::AsyncCall<__v8_baton_type> __v8_call(info);                             \
+  if (__v8_call.IsEmpty())                                                     \
+    V8_FAIL(v8u::TypeErr("Last argument must be a callback function."));       \
+  __v8_baton_type* baton = __v8_call.baton();                                  \
+  {
+
+#define V8_ASYNC_EXECUTE()                                                     \
+  }                                                                            \
+  struct __v8_async {                                                          \
+    static void Execute(__v8_baton_type* baton) {
+
+#define V8_ASYNC_COMPLETE()                                                    \
+    }                                                                          \
+    static v8::Handle<v8::Value> Complete(__v8_baton_type* baton) {
+
+#define __v8_async_queue                                                       \
+      return v8::Undefined();                                                  \
+    }                                                                          \
+  };                                                                           \
+  __v8_call.Queue(__v8_async::Execute, __v8_async::Complete);
+
+#define V8_ASYNC_END() __v8_async_queue V8_CB_END()
+
+#ifdef __v8_promises
+
+//// Same as V8_ASYNC_CB, but settles the returned promise (no callback taken)
+#define V8_ASYNC_PROMISE(IDENTIFIER, BATON)                                    \
+V8_PROMISE_CB(IDENTIFIER)                                                      \
+  typedef BATON __v8_baton_type;                                               \
+  v8u::AsyncCall<__v8_baton_type> __v8_call(deferred);                         \
+  __v8_baton_type* baton = __v8_call.baton();                                  \
+  {
+
+#define V8_ASYNC_PROMISE_END() __v8_async_queue V8_PROMISE_CB_END()
+
+#endif
+
+// Channels (native threads to JS)
+
+#if __cplusplus >= 201103L
+
+//// Items a Channel holds before Push() starts refusing them
+#ifndef V8U_CHANNEL_BOUND
+  #define V8U_CHANNEL_BOUND 65536
+#endif
+
+#if UV_VERSION_MAJOR >= 1
+  #define __uv_async_cb(IDENTIFIER) void IDENTIFIER(uv_async_t* handle)
+#else
+  #define __uv_async_cb(IDENTIFIER) void IDENTIFIER(uv_async_t* handle, int status)
+#endif
+
+/**
+ * Delivers values from any number of native threads to a JS callback, in
+ * batches: callback(null, [items...]), or callback(error) if converting
+ * them threw. Producers push onto a lock-free stack and only the one that
+ * finds it empty wakes the loop, so a single uv_async_send can carry any
+ * number of items. Each batch is converted (through ArgTraits<T>::New, or
+ * the given function) in a single handle scope, and makes a single call.
+ *
+ * Push() returns false once `bound` items are waiting, PushWait() blocks
+ * until there's room instead. Create and Close() the channel on the JS
+ * thread. Close() wakes producers blocked in PushWait() (which return
+ * false), waits for the ones already inside a push to leave, delivers
+ * what's left and frees the channel, so make sure no producer starts a
+ * push afterwards. An open channel keeps the event loop alive.
+ *
+ *   Channel<double>* channel = new Channel<double>(Func(info[0]));
+ *   // any thread:
+ *   channel->Push(3.14);
+ **/
+template <class T> class Channel {
+public:
+  typedef v8::Handle<v8::Value> (*Converter)(const T& value);
+
+  Channel(v8::Handle<v8::Function> callback, size_t bound = V8U_CHANNEL_BOUND)
+      : Channel(callback, bound, Convert) {}
+  //// T doesn't need ArgTraits with this one
+  Channel(v8::Handle<v8::Function> callback, size_t bound, Converter convert)
+      : callback_(callback), convert_(convert), bound_(bound), head_(nullptr),
+        size_(0), waiters_(0), users_(0), closed_(false) {
+    async_.data = this;
+    uv_async_init(uv_default_loop(), &async_, OnAsync);
+  }
+
+  bool Push(const T& value) {
+    if (!Enter()) return false;
+    bool pushed = TryPush(value);
+    Leave();
+    return pushed;
+  }
+  bool PushWait(const T& value) {
+    if (!Enter()) return false;
+    bool pushed;
+    while (!(pushed = TryPush(value)) && !closed_.load()) {
+      std::unique_lock<std::mutex> lock (mutex_);
+      waiters_++;
+      room_.wait(lock, [this] {
+        return size_.load() < bound_ || closed_.load();
+      });
+      waiters_--;
+    }
+    Leave();
+    return pushed;
+  }
+  inline size_t Size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+  void Close() {
+    if (closed_.exchange(true)) return;
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      room_.notify_all();
+    }
+    // Producers don't touch the channel after leaving, and they all leave
+    // promptly now, so nothing can enqueue or uv_async_send past this point
+    while (users_.load()) std::this_thread::yield();
+    Drain();
+    uv_close(reinterpret_cast<uv_handle_t*>(&async_), OnClose);
+  }
+private:
+  struct Node {
+    inline explicit Node(const T& value) : value(value), next(nullptr) {}
+    T value;
+    Node* next;
+  };
+
+  ~Channel() {
+    Node* node = head_.exchange(nullptr);
+    while (node) {
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+  Channel(const Channel&);
+  Channel& operator=(const Channel&);
+
+  static v8::Handle<v8::Value> Convert(const T& value) {
+    return ArgTraits<T>::New(value);
+  }
+
+  //// Counts the producer in, unless the channel is closed already
+  inline bool Enter() {
+    users_.fetch_add(1);
+    if (!closed_.load()) return true;
+    users_.fetch_sub(1);
+    return false;
+  }
+  inline void Leave() {
+    users_.fetch_sub(1);
+  }
+  inline bool TryPush(const T& value) {
+    if (size_.fetch_add(1, std::memory_order_relaxed) >= bound_) {
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      return false;
+    }
+    Enqueue(new Node(value));
+    return true;
+  }
+
+  inline void Enqueue(Node* node) {
+    Node* head = head_.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!head_.compare_exchange_weak(head, node, std::memory_order_release,
+                                          std::memory_order_relaxed));
+    // Whoever finds it empty wakes the loop, the rest ride along
+    if (!head) uv_async_send(&async_);
+  }
+
+  static __uv_async_cb(OnAsync) {
+    static_cast<Channel<T>*>(handle->data)->Drain();
+  }
+  static void OnClose(uv_handle_t* handle) {
+    delete static_cast<Channel<T>*>(handle->data);
+  }
+
+  void Drain() {
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    if (!node) return;
+
+    // The stack is newest first
+    Node* list = nullptr;
+    uint32_t count = 0;
+    while (node) {
+      Node* next = node->next;
+      node->next = list;
+      list = node;
+      node = next;
+      count++;
+    }
+    size_.fetch_sub(count);
+    if (waiters_.load()) {
+      std::lock_guard<std::mutex> lock (mutex_);
+      room_.notify_all();
+    }
+
+    V8_HANDLE_SCOPE(scope);
+    v8::Handle<v8::Value> error;
+    v8::Local<v8::Array> batch = v8::Array::New(count);
+    uint32_t i = 0;
+    __v8_try
+      for (node = list; node; node = node->next)
+        batch->Set(i++, convert_(node->value));
+    __v8_catch(__v8_async_error)
+    while (list) {
+      node = list->next;
+      delete list;
+      list = node;
+    }
+
+    v8::Handle<v8::Value> argv [2];
+    if (error.IsEmpty()) {
+      argv[0] = v8::Null();
+      argv[1] = batch;
+    } else {
+      argv[0] = error;
+      argv[1] = v8::Undefined();
+    }
+    node::MakeCallback(v8::Context::GetCurrent()->Global(), *callback_, 2, argv);
+  }
+
+  uv_async_t async_;
+  Persisted<v8::Function> callback_;
+  Converter convert_;
+  size_t bound_;
+  std::atomic<Node*> head_;
+  std::atomic<size_t> size_;
+  std::atomic<int> waiters_;
+  std::atomic<int> users_;
+  std::atomic<bool> closed_;
+  std::mutex mutex_;
+  std::condition_variable room_;
+};
+
+#endif
+
+// Cursors (C++ ranges handed to JS in batches)
+
+#if __cplusplus >= 201103L
+
+//// Items converted per native call
+#ifndef V8U_CURSOR_BATCH
+  #define V8U_CURSOR_BATCH 1024
+#endif
+
+//// Upper bound for any batch size, whatever C++ passes
+#ifndef V8U_CURSOR_MAX
+  #define V8U_CURSOR_MAX (64 * 1024)
+#endif
+
+namespace internal {
+
+//// Turns a native cursor into an iterator; next() only calls into C++
+//// once per batch. Plain ES5 so that it compiles on every V8.
+const char* const CursorShim =
+  "(function (cursor) {\n"
+  "  var items = [], index = 0, done = false;\n"
+  "  var it = {\n"
+  "    next: function () {\n"
+  "      while (index >= items.length && !done) {\n"
+  "        items = cursor.nextBatch() || [];\n"
+  "        index = 0;\n"
+  "        done = items.length === 0;\n"
+  "      }\n"
+  "      if (done) return {value: undefined, done: true};\n"
+  "      var value = items[index];\n"
+  "      items[index++] = undefined;\n"
+  "      return {value: value, done: false};\n"
+  "    },\n"
+  "    nextBatch: function (size) {\n"
+  "      if (index < items.length) {\n"
+  "        var rest = items.slice(index);\n"
+  "        items = [];\n"
+  "        index = 0;\n"
+  "        return rest;\n"
+  "      }\n"
+  "      return done ? null : cursor.nextBatch(size);\n"
+  "    },\n"
+  "    cursor: cursor\n"
+  "  };\n"
+  "  it['return'] = function (value) {\n"
+  "    done = true;\n"
+  "    items = [];\n"
+  "    cursor.close();\n"
+  "    return {value: value, done: true};\n"
+  "  };\n"
+  "  if (typeof Symbol === 'function' && Symbol.iterator)\n"
+  "    it[Symbol.iterator] = function () { return it; };\n"
+  "  if (typeof Symbol === 'function' && Symbol.asyncIterator)\n"
+  "    it[Symbol.asyncIterator] = function () {\n"
+  "      return {\n"
+  "        next: function () {\n"
+  "          try { return Promise.resolve(it.next()); }\n"
+  "          catch (e) { return Promise.reject(e); }\n"
+  "        },\n"
+  "        'return': function (value) {\n"
+  "          return Promise.resolve(it['return'](value));\n"
+  "        }\n"
+  "      };\n"
+  "    };\n"
+  "  return it;\n"
+  "})";
+
+};
+
+/**
+ * Exposes a C++ range or generator to JS without building one big array.
+ * The object returned by Iterate(), Own() and Generate() is an iterator
+ * (and iterable / async iterable where the engine has Symbol.iterator /
+ * Symbol.asyncIterator) that pulls `batch` items per native call; items
+ * go through ArgTraits<T>::New. `it.nextBatch([size])` hands out whole
+ * arrays instead, null once the source is exhausted; `size` can only make
+ * batches smaller. Batches never go over V8U_CURSOR_MAX items.
+ *
+ * The source (and whatever its functor captured) is released as soon as
+ * it runs out, when JS calls `return()` (i.e. breaking out of for...of),
+ * or when the iterator is collected, whichever comes first.
+ **/
+class Cursor : public node::ObjectWrap {
+public:
+  //// Fills the array with up to `max` items, returns how many
+  typedef std::function<uint32_t(v8::Local<v8::Array>, uint32_t)> Fill;
+
+  //// Range owned by the caller; it has to outlive the cursor
+  template <class It>
+  static v8::Local<v8::Object> Iterate(It begin, It end,
+                                      uint32_t batch = V8U_CURSOR_BATCH) {
+    typedef typename std::iterator_traits<It>::value_type T;
+    return New([begin, end](v8::Local<v8::Array> out, uint32_t max) mutable {
+      uint32_t n = 0;
+      for (; n < max && begin != end; ++begin, ++n)
+        out->Set(n, ArgTraits<T>::New(*begin));
+      return n;
+    }, batch);
+  }
+
+  //// Takes the container (moved or copied) and frees it with the cursor
+  template <class C>
+  static v8::Local<v8::Object> Own(C&& items, uint32_t batch = V8U_CURSOR_BATCH) {
+    typedef typename std::decay<C>::type Container;
+    typedef typename Container::value_type T;
+    std::shared_ptr<Container> owner = std::make_shared<Container>(std::forward<C>(items));
+    typename Container::const_iterator it = owner->begin();
+    return New([owner, it](v8::Local<v8::Array> out, uint32_t max) mutable {
+      uint32_t n = 0;
+      for (; n < max && it != owner->end(); ++it, ++n)
+        out->Set(n, ArgTraits<T>::New(*it));
+      return n;
+    }, batch);
+  }
+
+  /**
+   * GENERATOR is called as bool(T& item) and returns false once there's
+   * nothing left. It has to be copyable; keep native cursors behind a
+   * shared_ptr so that releasing the functor closes them.
+   **/
+  template <class T, class G>
+  static v8::Local<v8::Object> Generate(G generator, uint32_t batch = V8U_CURSOR_BATCH) {
+    return New([generator](v8::Local<v8::Array> out, uint32_t max) mutable {
+      uint32_t n = 0;
+      T item;
+      while (n < max && generator(item)) out->Set(n++, ArgTraits<T>::New(item));
+      return n;
+    }, batch);
+  }
+
+  static v8::Local<v8::Object> New(Fill fill, uint32_t batch = V8U_CURSOR_BATCH) {
+    V8_HANDLE_SCOPE(scope);
+    v8::Local<v8::Function> ctor = Template()->GetFunction();
+    v8::Local<v8::Object> obj = Template()->InstanceTemplate()->NewInstance();
+    internal::SetTag<Cursor>(obj);
+    (new Cursor(fill, batch))->Wrap(obj);
+
+    v8::Local<v8::String> key = V8U_SYMBOL("v8u::cursor");
+    v8::Local<v8::Value> shim = ctor->GetHiddenValue(key);
+    if (shim.IsEmpty()) {
+      shim = v8::Script::Compile(Str(internal::CursorShim), Str("v8u:cursor"))->Run();
+      ctor->SetHiddenValue(key, shim);
+    }
+    v8::Handle<v8::Value> argv [] = {obj};
+    return scope.Close(Obj(v8::Local<v8::Function>::Cast(shim)->Call(obj, 1, argv)));
+  }
+
+  inline bool IsClosed() const {
+    return !fill_;
+  }
+  //// Releases the source right away
+  inline void Close() {
+    fill_ = nullptr;
+  }
+
+  static V8_CB(NextBatch) {
+    V8_M_SELF(Cursor);
+    if (!inst->fill_) V8_RET(v8::Null());
+    // JS can ask for smaller batches, never for bigger ones
+    uint32_t max = inst->batch_;
+    if (info[0]->IsUint32() && Uint(info[0]) && Uint(info[0]) < max)
+      max = Uint(info[0]);
+
+    // Grows as items come, so a short batch doesn't pay for a long one
+    v8::Local<v8::Array> items = Arr();
+    uint32_t n = inst->fill_(items, max);
+    if (n < max) {
+      inst->Close();
+      if (!n) V8_RET(v8::Null());
+    }
+    V8_RET(items);
+  } V8_CB_END()
+
+  static V8_CB(CloseCb) {
+    V8_M_SELF(Cursor);
+    inst->Close();
+  } V8_CB_END()
+private:
+  Cursor(Fill fill, uint32_t batch)
+      : fill_(fill), batch_(std::min<uint32_t>(batch ? batch : 1, V8U_CURSOR_MAX)) {}
+
+  static v8::FunctionTemplate* Template() {
+    static TypeSlot templ_;
+    if (templ_.IsEmpty()) {
+      V8_HANDLE_SCOPE(scope);
+      v8::Persistent<v8::FunctionTemplate> templ =
+          v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New());
+      templ->SetClassName(V8U_SYMBOL("Cursor"));
+      templ->InstanceTemplate()->SetInternalFieldCount(2);
+      v8::Local<v8::Signature> signature = v8::Signature::New(templ);
+      v8::Local<v8::ObjectTemplate> prot = templ->PrototypeTemplate();
+      prot->Set(V8U_SYMBOL("nextBatch"), v8::FunctionTemplate::New(NextBatch,
+          v8::Handle<v8::Value>(), signature));
+      prot->Set(V8U_SYMBOL("close"), v8::FunctionTemplate::New(CloseCb,
+          v8::Handle<v8::Value>(), signature));
+      templ_.Set(*templ);
+    }
+    return templ_;
+  }
+
+  Fill fill_;
+  uint32_t batch_;
+};
+
+#endif
+
+// External memory (native allocations behind wrapped objects)
+
+//// Adjustments are batched until they add up to this many bytes
+#ifndef V8U_EXTERNAL_BATCH
+  #define V8U_EXTERNAL_BATCH (256 * 1024)
+#endif
+
+namespace internal {
+
+//// Per-type totals, kept in a list for ExternalMemoryObject()
+struct ExternalTotals {
+#if __cplusplus >= 201103L
+  typedef std::atomic<int64_t> Counter;
+#else
+  typedef volatile int64_t Counter;
+#endif
+
+  const char* name;
+  Counter objects;
+  Counter bytes;
+  ExternalTotals* next;
+
+  ExternalTotals(): name(NULL), objects(0), bytes(0) {
+    Mutex& mutex = Lock();
+    mutex.Lock();
+    next = Head();
+    Head() = this;
+    mutex.Unlock();
+  }
+
+  static inline ExternalTotals*& Head() {
+    static ExternalTotals* head = NULL;
+    return head;
+  }
+  static inline Mutex& Lock() {
+    static Mutex mutex;
+    return mutex;
+  }
+};
+
+template <class T> inline ExternalTotals& ExternalTotalsOf() {
+  static ExternalTotals totals;
+  return totals;
+}
+
+//// Bytes not yet reported to V8 by this thread
+inline int64_t& ExternalPending() {
+  static __v8_thread_local int64_t pending = 0;
+  return pending;
+}
+
+inline void AdjustExternal(int64_t delta) {
+  int64_t& pending = ExternalPending();
+  pending += delta;
+  if (pending >= V8U_EXTERNAL_BATCH || pending <= -V8U_EXTERNAL_BATCH) {
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(pending);
+    pending = 0;
+  }
+}
+
+/**
+ * Lives inside every V8_EXTERNAL instance and remembers how much was
+ * reported for it (and under which type), so that exactly that is taken
+ * back when the object is destroyed. Copies start at zero: they aren't
+ * wrapped yet.
+ **/
+class ExternalSlot {
+public:
+  inline ExternalSlot() : size_(0), totals_(NULL) {}
+  inline ExternalSlot(const ExternalSlot&) : size_(0), totals_(NULL) {}
+  inline ExternalSlot& operator=(const ExternalSlot&) {
+    return *this;
+  }
+  inline ~ExternalSlot() {
+    Set(0, NULL);
+  }
+
+  void Set(size_t size, ExternalTotals* totals) {
+    if (size == size_) return;
+    if (!totals_) totals_ = totals;
+    if (!size_) totals_->objects += 1;
+    else if (!size) totals_->objects -= 1;
+    int64_t delta = int64_t(size) - int64_t(size_);
+    totals_->bytes += delta;
+    size_ = size;
+    AdjustExternal(delta);
+  }
+  inline size_t Get() const {
+    return size_;
+  }
+private:
+  size_t size_;
+  ExternalTotals* totals_;
+};
+
+template <bool> struct Bool {};
+
+//// V8_EXTERNAL befriends it, so it works from a private section too
+struct External {
+  template <class T> static char Test(typename T::__v8_external_tag*);
+  template <class T> static long Test(...);
+
+  template <class T> static inline void Account(T* inst, Bool<false>) {}
+  template <class T> static inline void Account(T* inst, Bool<true>) {
+    inst->__v8_external.Set(inst->ExternalSize(), &ExternalTotalsOf<T>());
+  }
+};
+
+//// Whether T (or a base) was declared with V8_EXTERNAL
+template <class T> struct HasExternal {
+  enum { value = sizeof(External::Test<T>(0)) == sizeof(char) };
+};
+
+//// Called when an instance gets wrapped, does nothing without V8_EXTERNAL
+template <class T> inline T* Account(T* inst) {
+  External::Account(inst, Bool<HasExternal<T>::value>());
+  return inst;
+}
+
+template <class T> inline void NameExternal(const char* name) {
+  if (HasExternal<T>::value) ExternalTotalsOf<T>().name = name;
+}
+
+};
+
+//// Reports what this thread has batched so far to V8 right away
+inline void FlushExternalMemory() {
+  int64_t& pending = internal::ExternalPending();
+  if (!pending) return;
+  v8::V8::AdjustAmountOfExternalAllocatedMemory(pending);
+  pending = 0;
+}
+
+/**
+ * {pending: bytes, types: {Name: {objects: n, bytes: n}}} for every
+ * V8_EXTERNAL type that has had instances. Goes into stats() when
+ * V8U_STATS is defined.
+ **/
+inline v8::Local<v8::Object> ExternalMemoryObject() {
+  V8_HANDLE_SCOPE(scope);
+  v8::Local<v8::Object> types = Obj();
+  internal::Mutex& mutex = internal::ExternalTotals::Lock();
+  mutex.Lock();
+  for (internal::ExternalTotals* it = internal::ExternalTotals::Head(); it; it = it->next) {
+    v8::Local<v8::Object> entry = Obj();
+    entry->Set(V8U_SYMBOL("objects"), Num(double(int64_t(it->objects))));
+    entry->Set(V8U_SYMBOL("bytes"), Num(double(int64_t(it->bytes))));
+    types->Set(Str(it->name ? it->name : "(unnamed)"), entry);
+  }
+  mutex.Unlock();
+
+  v8::Local<v8::Object> ret = Obj();
+  ret->Set(V8U_SYMBOL("pending"), Num(double(internal::ExternalPending())));
+  ret->Set(V8U_SYMBOL("types"), types);
+  return scope.Close(ret);
+}
+
+/**
+ * Opts a V8_TYPE into external memory accounting. Put it in the class and
+ * define `size_t ExternalSize() const` (it can be inherited): V8_WRAP and
+ * Wrapped() report it to V8, and it's taken back when the object dies.
+ * Costs two words per instance, which is why it's not in V8_TYPE.
+ **/
+#define V8_EXTERNAL(CPP_TYPE)                                                  \
+  friend struct v8u::internal::External;                                       \
+  typedef void __v8_external_tag;                                              \
+  v8u::internal::ExternalSlot __v8_external;                                   \
+  /** Call when ExternalSize() changes, to tell V8 **/                         \
+  inline void ExternalSizeChanged() {                                          \
+    v8u::internal::Account(this);                                              \
+  }
+
+// Lazy registration
+
+namespace internal {
+
+typedef void (*LazyInit)(v8::Handle<v8::Object> target);
+
+//// Swaps itself for whatever INIT puts on the target
+template <LazyInit INIT> inline V8_GET(LazyGet) {
+  v8::Local<v8::Object> holder = info.Holder();
+  holder->Delete(name);
+  INIT(holder);
+  V8_RET(holder->Get(name));
+} V8_GET_END()
+
+//// Assigning before the first read just replaces the accessor
+inline V8_SET(LazySet) {
+  v8::Local<v8::Object> holder = info.Holder();
+  holder->Delete(name);
+  holder->Set(name, value);
+} V8_SET_END()
+
+template <LazyInit INIT>
+inline void Lazy(v8::Handle<v8::Object> target, v8::Handle<v8::String> name) {
+  target->SetAccessor(name, LazyGet<INIT>, LazySet);
+}
+
+};
+
+// Defining things
+
+#define V8_DEF_TYPE_PRE()                                                      \
+  v8::Persistent<v8::FunctionTemplate> templ;                                  \
+  v8::Local<v8::ObjectTemplate> prot;                                          \
+  v8::Local<v8::ObjectTemplate> inst;                                          \
+  v8::Handle<v8::String> __cname;                                              \
+  v8u::internal::TypeTag* __v8_tag = NULL;                                     \
+  (void) __v8_tag;
+
+#define V8_DEF_TYPE(V8_NAME)                                                   \
+  templ = v8::Persistent<v8::FunctionTemplate>::New(                           \
+      v8::FunctionTemplate::New(NewInstance));                                 \
+  __cname = v8u::Symbol(V8_NAME);                                              \
+  templ->SetClassName(__cname);                                                \
+  inst = templ->InstanceTemplate();                                            \
+  inst->SetInternalFieldCount(2);                                              \
+  prot = templ->PrototypeTemplate();
+
+#define V8_DEF_ACC(V8_NAME, GETTER, SETTER)                                    \
+  inst->SetAccessor(v8u::Symbol(V8_NAME), GETTER, SETTER)
+
+#define V8_DEF_GET(V8_NAME, GETTER)                                            \
+  inst->SetAccessor(v8u::Symbol(V8_NAME), GETTER)
+
+//FIXME: add V8_DEF_SET
+
+//// Goes on the prototype, and V8 checks the receiver (see V8_M_SELF)
+#define V8_DEF_CB(V8_NAME, CPP_METHOD)                                         \
+  prot->Set(v8u::Symbol(V8_NAME), v8::FunctionTemplate::New(CPP_METHOD,        \
+      v8::Handle<v8::Value>(), v8::Signature::New(templ)))
+
+//// Goes on the constructor itself, i.e. Version.parseAll()
+#define V8_DEF_STATIC(V8_NAME, CPP_METHOD)                                     \
+  templ->Set(v8u::Symbol(V8_NAME), v8::FunctionTemplate::New(CPP_METHOD))
+
+#define V8_INHERIT(CPP_TYPE) v8u::internal::Inherit<CPP_TYPE>(templ, __v8_tag)
+
+// Templates for definition methods on Node
+
+//// Generic define function
+
+#define NODE_DEF(IDENTIFIER)                                                   \
+  void IDENTIFIER(v8::Handle<v8::Object> target)
+
+//// Module define function
+
+#ifdef V8U_STATS
+namespace internal {
+
+inline V8_SCB(Stats) {
+  V8_HANDLE_SCOPE(scope);
+  v8::Local<v8::Object> ret = StatsObject();
+  ret->Set(V8U_SYMBOL("external"), ExternalMemoryObject());
+  V8_RET(ret);
+}
+
+};
+
+  #define __v8_stats_export                                                    \
+    target->Set(V8U_SYMBOL("stats"), v8u::Func(v8u::internal::Stats));
+#else
+  #define __v8_stats_export
+#endif
+
+//// With V8U_STATS, the module gets a stats() function
+#define NODE_DEF_MAIN()                                                        \
+  extern "C" {                                                                 \
+    NODE_DEF(init) {                                                           \
+      V8_HANDLE_SCOPE(scope);                                                  \
+      __v8_stats_export
+
+#define NODE_DEF_MAIN_END(MODULE) }                                            \
+    NODE_MODULE(MODULE, init); }
+
+/**
+ * Inside NODE_DEF_MAIN, instead of calling INIT right away: puts a getter
+ * named V8_NAME on the target that calls INIT on first access, which then
+ * becomes a plain property. V8_NAME has to be the name INIT defines, i.e.
+ * NODE_DEF_LAZY("Version", v8u::Version::init). INIT has to be a function
+ * with external linkage, it goes in as a template argument. Types built by
+ * NODE_TYPE also get built when C++ needs them first (Wrapped(), V8_INHERIT),
+ * but only their template: init() still runs once, when JS asks.
+ **/
+#define NODE_DEF_LAZY(V8_NAME, INIT)                                           \
+  v8u::internal::Lazy<INIT>(target, v8u::Symbol(V8_NAME))
+
+//// Type (class) define function
+
+#define NODE_SDEF_TYPE() static NODE_DEF(init)
+#define NODE_ESDEF_TYPE(TYPE)   NODE_DEF(TYPE::init)
+
+#define NODE_DEF_TYPE(V8_NAME)                                                 \
+  inline NODE_SDEF_TYPE() {                                                    \
+    V8_HANDLE_SCOPE(scope);                                                    \
+    V8_DEF_TYPE_PRE()                                                          \
+    V8_DEF_TYPE(V8_NAME)
+
+#define NODE_EDEF_TYPE(TYPE, V8_NAME)                                          \
+  NODE_ESDEF_TYPE(TYPE) {                                                      \
+    V8_HANDLE_SCOPE(scope);                                                    \
+    V8_DEF_TYPE_PRE()                                                          \
+    V8_DEF_TYPE(V8_NAME)
+
+#define NODE_DEF_TYPE_END()                                                    \
+    target->Set(__cname, templ->GetFunction());                                \
+  }
+
+//// V8_TYPE + NODE_DEF_TYPE = NODE_TYPE
+
+#define NODE_STYPE(CPP_TYPE)                                                   \
+  V8_STYPE(CPP_TYPE);                                                          \
+  static void __v8_build();                                                    \
+  NODE_SDEF_TYPE()
+
+/**
+ * The body of NODE_TYPE goes in __v8_build(), which only fills templ_ (so
+ * there's no target in it). init() builds on first use and exports.
+ **/
+#define NODE_TYPE(CPP_TYPE, V8_NAME)                                           \
+  V8_TYPE(CPP_TYPE)                                                            \
+  inline NODE_SDEF_TYPE() {                                                    \
+    V8_HANDLE_SCOPE(scope);                                                    \
+    if (templ_.IsEmpty()) __v8_build();                                        \
+    target->Set(v8u::Symbol(V8_NAME), v8::Handle<v8::Function>(templ_->GetFunction()));\
+  }                                                                            \
+  static void __v8_build() {                                                   \
+    V8_HANDLE_SCOPE(scope);                                                    \
+    V8_DEF_TYPE_PRE()                                                          \
+    __v8_tag = &v8u::internal::TypeTagOf<CPP_TYPE>();                          \
+    v8u::internal::NameExternal<CPP_TYPE>(V8_NAME);                            \
+    V8_DEF_TYPE(V8_NAME)
+
+#define NODE_ETYPE(TYPE, V8_NAME)                                              \
+  V8_ETYPE(TYPE)                                                               \
+  NODE_ESDEF_TYPE(TYPE) {                                                      \
+    V8_HANDLE_SCOPE(scope);                                                    \
+    if (templ_.IsEmpty()) __v8_build();                                        \
+    target->Set(v8u::Symbol(V8_NAME), v8::Handle<v8::Function>(templ_->GetFunction()));\
+  }                                                                            \
+  void TYPE::__v8_build() {                                                    \
+    V8_HANDLE_SCOPE(scope);                                                    \
+    V8_DEF_TYPE_PRE()                                                          \
+    __v8_tag = &v8u::internal::TypeTagOf<TYPE>();                              \
+    v8u::internal::NameExternal<TYPE>(V8_NAME);                                \
+    V8_DEF_TYPE(V8_NAME)
+
+#define NODE_TYPE_POOLED(CPP_TYPE, V8_NAME)                                    \
+  V8_POOLED(CPP_TYPE)                                                          \
+  NODE_TYPE(CPP_TYPE, V8_NAME)
+
+#define NODE_TYPE_END()                                                        \
+    templ_.Set(*templ);                                                        \
+  }
 
 };
 
@@ -28,88 +28,336 @@
 #ifndef V8U_VERSION_HPP
 #define	V8U_VERSION_HPP
 
-#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
 
 #include "v8u.hpp"
 
 namespace v8u {
 
+namespace internal {
+
+//// Hand-written scanner for versions ("v1.2.3+build") and partials ("1.x")
+class VersionScanner {
+public:
+  enum { FIELD_MAX = 0x1FFFFF };
+
+  VersionScanner(const char* str, size_t length): p(str), end(str + length) {}
+
+  inline bool End() const {return p == end;}
+  inline bool Peek(char c) const {return p != end && *p == c;}
+  inline bool Accept(char c) {
+    if (!Peek(c)) return false;
+    p++;
+    return true;
+  }
+  inline void Spaces() {
+    while (p != end && (*p == ' ' || *p == '\t')) p++;
+  }
+
+  bool Number(int& value) {
+    if (p == end || *p < '0' || *p > '9') return false;
+    value = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+      value = value * 10 + (*p++ - '0');
+      if (value > FIELD_MAX) return false;
+    }
+    return true;
+  }
+
+  //// Fills up to three parts; `count` is how many were given (not wildcards)
+  bool Partial(int* parts, int& count) {
+    bool wildcard = false;
+    count = 0;
+    if (!Accept('v')) Accept('V');
+    for (int i = 0; i < 3; i++) {
+      parts[i] = 0;
+      if (wildcard || (i && !Accept('.'))) continue;
+      if (Accept('x') || Accept('X') || Accept('*')) {
+        wildcard = true;
+        continue;
+      }
+      if (!Number(parts[i])) return false;
+      count++;
+    }
+    // Prereleases have no place in the packed key
+    if (Peek('-')) return false;
+    if (Accept('+')) {
+      while (p != end && (std::isalnum(static_cast<unsigned char>(*p)) ||
+                          *p == '.' || *p == '-')) p++;
+    }
+    return true;
+  }
+
+  const char* p;
+  const char* end;
+};
+
+};
+
+class VersionRange;
+
+/**
+ * The three numbers live packed in a 64-bit key (21 bits each, major on top),
+ * so ordering two versions is a single integer compare. Numbers go from 0 to
+ * 2097151 (FIELD_MAX): from JS, anything else is a RangeError, the same way
+ * Parse() rejects it in strings. The C++ constructor and setters clamp.
+ **/
 class Version: public node::ObjectWrap {
 public:
-  Version(int major, int minor, int revision): major_(major), minor_(minor),
-                                               revision_(revision) {}
-  Version(Version& other): major_(other.major_), minor_(other.minor_),
-                           revision_(other.revision_) {}
+  enum { FIELD_BITS = 21, FIELD_MAX = internal::VersionScanner::FIELD_MAX };
+  //// Key of entries that didn't parse; sorts last, matches no range
+  static const uint64_t INVALID = ~uint64_t(0);
+
+  Version(int major, int minor, int revision):
+      key_(Pack(major, minor, revision)) {}
+  Version(const Version& other): key_(other.key_) {}
   ~Version() {}
   V8_CTOR() {
-    int arg0 = Int(args[0]);
-    int arg1 = Int(args[1]);
-    int arg2 = Int(args[2]);
+    V8_CHECK(v8u::CheckArguments(3, info));
+    int arg0, arg1, arg2;
+    V8_CHECK(FieldOf(info[0], arg0));
+    V8_CHECK(FieldOf(info[1], arg1));
+    V8_CHECK(FieldOf(info[2], arg2));
 
     V8_WRAP(new Version(arg0, arg1, arg2));
   } V8_CTOR_END()
 
-  int getMajor() const {return major_;}
-  int getMinor() const {return minor_;}
-  int getRevision() const {return revision_;}
+  static uint64_t Pack(int major, int minor, int revision) {
+    return (uint64_t(Clamp(major)) << (2*FIELD_BITS)) |
+           (uint64_t(Clamp(minor)) << FIELD_BITS) | uint64_t(Clamp(revision));
+  }
+  static int Major(uint64_t key) {return int(key >> (2*FIELD_BITS));}
+  static int Minor(uint64_t key) {return int((key >> FIELD_BITS) & FIELD_MAX);}
+  static int Revision(uint64_t key) {return int(key & FIELD_MAX);}
+
+  //// Parses an exact version ("1.2.3", "v1.2.3+build"), no prereleases
+  static bool Parse(const char* str, size_t length, uint64_t& key) {
+    internal::VersionScanner scanner (str, length);
+    int parts [3], count;
+    scanner.Spaces();
+    if (!scanner.Partial(parts, count) || count != 3) return false;
+    scanner.Spaces();
+    if (!scanner.End()) return false;
+    key = Pack(parts[0], parts[1], parts[2]);
+    return true;
+  }
+
+  //// Key of a Version instance or a version string
+  static bool KeyOf(v8::Handle<v8::Value> value, uint64_t& key) {
+    if (internal::IsTagged<Version>(value)) {
+      key = Unwrap(Obj(value))->key_;
+      return true;
+    }
+    if (!value->IsString()) return false;
+    Utf8 str (value);
+    return Parse(str.data(), str.length(), key);
+  }
 
-  void setMajor(int major) {major_=major;}
-  void setMinor(int minor) {minor_=minor;}
-  void setRevision(int revision) {revision_=revision;}
+  //// One key per line (\n or \r\n); bad lines get INVALID
+  static void ParseLines(const char* data, size_t length,
+                         std::vector<uint64_t>& keys) {
+    const char* end = data + length;
+    while (data < end) {
+      const char* eol = static_cast<const char*>(memchr(data, '\n', end - data));
+      if (!eol) eol = end;
+      size_t n = eol - data;
+      if (n && data[n-1] == '\r') n--;
+      uint64_t key = INVALID;
+      Parse(data, n, key);
+      keys.push_back(key);
+      data = eol + 1;
+    }
+  }
+
+  //// Buffer of packed keys, as returned by Version.parseAll()
+  static bool KeysOf(v8::Handle<v8::Value> value, const char*& data,
+                     size_t& count) {
+    Bytes bytes (value);
+    if (bytes.IsEmpty() || bytes.length() % sizeof(uint64_t)) return false;
+    data = bytes.data();
+    count = bytes.length() / sizeof(uint64_t);
+    return true;
+  }
+  static inline uint64_t KeyAt(const char* data, size_t index) {
+    uint64_t key;
+    memcpy(&key, data + index * sizeof(key), sizeof(key));
+    return key;
+  }
+  //// Moves the keys into a Buffer; they stay on the stack until then
+  static v8::Local<v8::Object> KeysBuffer(std::vector<uint64_t>& keys) {
+    std::vector<uint64_t>* owner = new std::vector<uint64_t>;
+    owner->swap(keys);
+    return Bytes::New(owner);
+  }
+
+  static std::string Format(uint64_t key) {
+    char ret [24];
+    int length = snprintf(ret, sizeof(ret), "%d.%d.%d", Major(key), Minor(key),
+                          Revision(key));
+    return std::string(ret, length);
+  }
+
+  int getMajor() const {return Major(key_);}
+  int getMinor() const {return Minor(key_);}
+  int getRevision() const {return Revision(key_);}
+  uint64_t getKey() const {return key_;}
+
+  void setMajor(int major) {key_ = Pack(major, getMinor(), getRevision());}
+  void setMinor(int minor) {key_ = Pack(getMajor(), minor, getRevision());}
+  void setRevision(int revision) {key_ = Pack(getMajor(), getMinor(), revision);}
+
+  int compare(const Version& other) const {
+    return key_ < other.key_ ? -1 : key_ > other.key_ ? 1 : 0;
+  }
+  inline bool satisfies(const VersionRange& range) const;
 
   std::string toString() const {
-    std::stringstream ret;
-    ret << major_ << "." << minor_ << "." << revision_;
-    return ret.str();
+    return Format(key_);
   }
 
   static V8_CB(ToArray) {
-    Version* inst = Unwrap(args.This());
+    V8_M_SELF(Version);
     v8::Local<v8::Array> arr = Arr(3);
-    arr->Set(0, Int(inst->major_));
-    arr->Set(1, Int(inst->minor_));
-    arr->Set(2, Int(inst->revision_));
+    arr->Set(0, Int(inst->getMajor()));
+    arr->Set(1, Int(inst->getMinor()));
+    arr->Set(2, Int(inst->getRevision()));
     V8_RET(arr);
   } V8_CB_END()
 
   static V8_CB(ToString) {
-    Version* inst = Unwrap(args.This());
+    V8_M_SELF(Version);
     std::string ret = inst->toString();
     V8_RET(Str(ret.data(), ret.size()));
   } V8_CB_END()
 
   static V8_CB(Inspect) {
-    Version* inst = Unwrap(args.This());
+    V8_M_SELF(Version);
     std::string ret = "<Version "+inst->toString()+">";
     V8_RET(Str(ret.data(), ret.size()));
   } V8_CB_END()
 
+  //// Takes a Version or a version string, returns -1, 0 or 1
+  static V8_CB(Compare) {
+    V8_M_SELF(Version);
+    uint64_t other;
+    if (!KeyOf(info[0], other)) V8_STHROW(v8u::TypeErr("Invalid version."));
+    V8_RET(Int(inst->key_ < other ? -1 : inst->key_ > other ? 1 : 0));
+  } V8_CB_END()
+
+  //// Takes a VersionRange or a range string
+  static V8_SCB(Satisfies);
+
+  // Bulk operations on packed keys, no wrappers involved
+
+  //// Array of strings, or newline-separated string or Buffer, to a Buffer
+  //// of keys; entries that don't parse get INVALID so indices still match
+  static V8_CB(ParseAll) {
+    std::vector<uint64_t> keys;
+    if (info[0]->IsArray()) {
+      v8::Local<v8::Array> array = Arr(info[0]);
+      uint32_t length = array->Length();
+      keys.resize(length, uint64_t(INVALID));
+      for (uint32_t start = 0; start < length; start += V8U_ARRAY_CHUNK) {
+        V8_HANDLE_SCOPE(scope);
+        uint32_t end = std::min<uint32_t>(length, start + V8U_ARRAY_CHUNK);
+        for (uint32_t i = start; i < end; i++) {
+          v8::Local<v8::Value> item = array->Get(i);
+          if (!item->IsString()) continue;
+          Utf8 str (item);
+          Parse(str.data(), str.length(), keys[i]);
+        }
+      }
+    } else if (info[0]->IsString()) {
+      Utf8 str (info[0]);
+      ParseLines(str.data(), str.length(), keys);
+    } else {
+      Bytes bytes (info[0]);
+      if (bytes.IsEmpty())
+        V8_STHROW(v8u::TypeErr("Array, string or Buffer expected."));
+      ParseLines(bytes.data(), bytes.length(), keys);
+    }
+    V8_RET(KeysBuffer(keys));
+  } V8_CB_END()
+
+  //// New Buffer with the keys sorted, without duplicates or INVALID
+  static V8_CB(Sort) {
+    const char* data;
+    size_t count;
+    if (!KeysOf(info[0], data, count))
+      V8_STHROW(v8u::TypeErr("Buffer of version keys expected."));
+    std::vector<uint64_t> keys (count);
+    if (count) memcpy(&keys[0], data, count * sizeof(uint64_t));
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    if (!keys.empty() && keys.back() == INVALID) keys.pop_back();
+    V8_RET(KeysBuffer(keys));
+  } V8_CB_END()
+
+  //// Array of version strings (null for INVALID)
+  static V8_CB(Stringify) {
+    const char* data;
+    size_t count;
+    if (!KeysOf(info[0], data, count))
+      V8_STHROW(v8u::TypeErr("Buffer of version keys expected."));
+    v8::Local<v8::Array> ret = Arr(count);
+    for (size_t start = 0; start < count; start += V8U_ARRAY_CHUNK) {
+      V8_HANDLE_SCOPE(scope);
+      size_t end = std::min<size_t>(count, start + V8U_ARRAY_CHUNK);
+      for (size_t i = start; i < end; i++) {
+        uint64_t key = KeyAt(data, i);
+        if (key == INVALID) {
+          ret->Set(i, v8::Null());
+          continue;
+        }
+        std::string str = Format(key);
+        ret->Set(i, Str(str.data(), str.size()));
+      }
+    }
+    V8_RET(ret);
+  } V8_CB_END()
+
+  //// Indices of the keys in a range (VersionRange or range string)
+  static V8_SCB(Filter);
+  //// Same, but returns a Buffer with the matching keys themselves
+  static V8_SCB(FilterKeys);
+
   //Getters
-  V8_GET(GetMajor) {
+  static V8_GET(GetMajor) {
     Version* inst = Unwrap(info.Holder());
-    V8_RET(Int(inst->major_));
+    V8_CHECK(inst);
+    V8_RET(Int(inst->getMajor()));
   } V8_GET_END()
-  V8_GET(GetMinor) {
+  static V8_GET(GetMinor) {
     Version* inst = Unwrap(info.Holder());
-    V8_RET(Int(inst->minor_));
+    V8_CHECK(inst);
+    V8_RET(Int(inst->getMinor()));
   } V8_GET_END()
-  V8_GET(GetRevision) {
+  static V8_GET(GetRevision) {
     Version* inst = Unwrap(info.Holder());
-    V8_RET(Int(inst->revision_));
+    V8_CHECK(inst);
+    V8_RET(Int(inst->getRevision()));
   } V8_GET_END()
 
   //Setters
-  V8_SET(SetMajor) {
+  static V8_SET(SetMajor) {
     Version* inst = Unwrap(info.Holder());
-    inst->major_ = Int(value);
+    int major;
+    V8_CHECK(inst && FieldOf(value, major));
+    inst->setMajor(major);
   } V8_SET_END()
-  V8_SET(SetMinor) {
+  static V8_SET(SetMinor) {
     Version* inst = Unwrap(info.Holder());
-    inst->minor_ = Int(value);
+    int minor;
+    V8_CHECK(inst && FieldOf(value, minor));
+    inst->setMinor(minor);
   } V8_SET_END()
-  V8_SET(SetRevision) {
+  static V8_SET(SetRevision) {
     Version* inst = Unwrap(info.Holder());
-    inst->revision_ = Int(value);
+    int revision;
+    V8_CHECK(inst && FieldOf(value, revision));
+    inst->setRevision(revision);
   } V8_SET_END()
 
   NODE_TYPE(Version, "Version") {
@@ -120,12 +368,282 @@ public:
     V8_DEF_CB("toString", ToString);
     V8_DEF_CB("toArray", ToArray);
     V8_DEF_CB("inspect", Inspect);
+    V8_DEF_CB("compare", Compare);
+    V8_DEF_CB("satisfies", Satisfies);
+
+    V8_DEF_STATIC("parseAll", ParseAll);
+    V8_DEF_STATIC("sort", Sort);
+    V8_DEF_STATIC("stringify", Stringify);
+    V8_DEF_STATIC("filter", Filter);
+    V8_DEF_STATIC("filterKeys", FilterKeys);
   } NODE_TYPE_END()
 private:
-  int major_, minor_, revision_;
+  //// For C++ callers, JS values go through FieldOf() instead
+  static int Clamp(int n) {
+    return n < 0 ? 0 : n > FIELD_MAX ? int(FIELD_MAX) : n;
+  }
+  //// Rejects what Parse() would: negatives, past FIELD_MAX (and NaN)
+  static bool FieldOf(v8::Handle<v8::Value> value, int& field) {
+    double number = Num(value);
+    if (!(number >= 0 && number <= FIELD_MAX)) {
+      __v8_raise(v8u::RangeErr("Version numbers go from 0 to 2097151."));
+      return false;
+    }
+    field = int(number);
+    return true;
+  }
+
+  uint64_t key_;
 };
 V8_POST_TYPE(Version)
 
+/**
+ * A semver range ("^1.2", "~2.3.4", ">=1 <3 || 4.x", "1.2 - 2"...) compiled
+ * once into a sorted set of disjoint [low, high) intervals of version keys.
+ * Testing a version is then a couple of integer compares per interval.
+ **/
+class VersionRange: public node::ObjectWrap {
+public:
+  struct Interval {
+    uint64_t low, high;
+    bool operator<(const Interval& other) const {return low < other.low;}
+  };
+  static const uint64_t MAX = uint64_t(1) << 63;
+
+  VersionRange() {}
+  ~VersionRange() {}
+  V8_CTOR() {
+    if (!info[0]->IsString()) V8_STHROW(v8u::TypeErr("Invalid version range."));
+    VersionRange* range = new VersionRange;
+    Utf8 str (info[0]);
+    if (!range->parse(str.data(), str.length())) {
+      delete range;
+      V8_STHROW(v8u::TypeErr("Invalid version range."));
+    }
+    V8_WRAP(range);
+  } V8_CTOR_END()
+
+  //// Returns false on syntax errors (the range is then left empty)
+  bool parse(const char* str, size_t length) {
+    internal::VersionScanner scanner (str, length);
+    intervals_.clear();
+    for (;;) {
+      Interval range = {0, MAX}, part;
+      scanner.Spaces();
+      while (!scanner.End() && !scanner.Peek('|')) {
+        if (!Comparator(scanner, part)) {
+          intervals_.clear();
+          return false;
+        }
+        range.low = std::max(range.low, part.low);
+        range.high = std::min(range.high, part.high);
+        scanner.Spaces();
+      }
+      if (range.low < range.high) intervals_.push_back(range);
+      if (scanner.End()) break;
+      if (!scanner.Accept('|') || !scanner.Accept('|')) {
+        intervals_.clear();
+        return false;
+      }
+    }
+
+    // Sort and merge
+    std::sort(intervals_.begin(), intervals_.end());
+    size_t last = 0;
+    for (size_t i = 1; i < intervals_.size(); i++) {
+      if (intervals_[i].low <= intervals_[last].high)
+        intervals_[last].high = std::max(intervals_[last].high, intervals_[i].high);
+      else
+        intervals_[++last] = intervals_[i];
+    }
+    if (!intervals_.empty()) intervals_.resize(last + 1);
+    return true;
+  }
+
+  bool test(uint64_t key) const {
+    for (size_t i = 0; i < intervals_.size(); i++) {
+      if (key < intervals_[i].low) return false;
+      if (key < intervals_[i].high) return true;
+    }
+    return false;
+  }
+  bool test(const Version& version) const {
+    return test(version.getKey());
+  }
+
+  const std::vector<Interval>& intervals() const {return intervals_;}
+
+  //// The VersionRange passed, or `scratch` parsed from a range string
+  static const VersionRange* From(v8::Handle<v8::Value> value,
+                                  VersionRange& scratch) {
+    if (internal::IsTagged<VersionRange>(value)) return Unwrap(Obj(value));
+    if (!value->IsString()) return NULL;
+    Utf8 str (value);
+    return scratch.parse(str.data(), str.length()) ? &scratch : NULL;
+  }
+
+  //// Canonical form, i.e. ">=1.2.3 <2.0.0 || 3.0.1"
+  std::string toString() const {
+    if (intervals_.empty()) return "<0.0.0";
+    std::string ret;
+    for (size_t i = 0; i < intervals_.size(); i++) {
+      const Interval& it = intervals_[i];
+      if (i) ret += " || ";
+      if (it.low + 1 == it.high) {
+        ret += Version::Format(it.low);
+        continue;
+      }
+      if (it.low == 0 && it.high == MAX) ret += "*";
+      if (it.low != 0) ret += ">=" + Version::Format(it.low);
+      if (it.low != 0 && it.high != MAX) ret += " ";
+      if (it.high != MAX) ret += "<" + Version::Format(it.high);
+    }
+    return ret;
+  }
+
+  //// Takes a Version or a version string
+  static V8_CB(Test) {
+    V8_M_SELF(VersionRange);
+    uint64_t key;
+    if (!Version::KeyOf(info[0], key)) V8_STHROW(v8u::TypeErr("Invalid version."));
+    V8_RET(Bool(inst->test(key)));
+  } V8_CB_END()
+
+  static V8_CB(ToString) {
+    V8_M_SELF(VersionRange);
+    std::string ret = inst->toString();
+    V8_RET(Str(ret.data(), ret.size()));
+  } V8_CB_END()
+
+  static V8_CB(Inspect) {
+    V8_M_SELF(VersionRange);
+    std::string ret = "<VersionRange "+inst->toString()+">";
+    V8_RET(Str(ret.data(), ret.size()));
+  } V8_CB_END()
+
+  NODE_TYPE(VersionRange, "VersionRange") {
+    V8_DEF_CB("test", Test);
+    V8_DEF_CB("toString", ToString);
+    V8_DEF_CB("inspect", Inspect);
+  } NODE_TYPE_END()
+private:
+  static const uint64_t MINOR = uint64_t(1) << Version::FIELD_BITS;
+  static const uint64_t MAJOR = uint64_t(1) << (2*Version::FIELD_BITS);
+
+  //// First key after everything the partial covers ("1.2" -> 1.3.0)
+  static uint64_t After(uint64_t low, int count) {
+    switch (count) {
+      case 0: return MAX;
+      case 1: return low + MAJOR;
+      case 2: return low + MINOR;
+    }
+    return low + 1;
+  }
+
+  static bool Comparator(internal::VersionScanner& scanner, Interval& ret) {
+    char op = 0;
+    bool equal = false;
+    if (scanner.Accept('<')) op = '<';
+    else if (scanner.Accept('>')) op = '>';
+    else if (scanner.Accept('~')) op = '~', scanner.Accept('>');
+    else if (scanner.Accept('^')) op = '^';
+    if ((op == 0 || op == '<' || op == '>') && scanner.Accept('=')) equal = true;
+    scanner.Spaces();
+
+    int parts [3], count;
+    if (!scanner.Partial(parts, count)) return false;
+    uint64_t low = Version::Pack(parts[0], parts[1], parts[2]);
+    uint64_t after = After(low, count);
+
+    switch (op) {
+      case '<':
+        ret.low = 0;
+        ret.high = equal ? after : low;
+        return true;
+      case '>':
+        ret.low = equal ? low : after;
+        ret.high = MAX;
+        return true;
+      case '~':
+        ret.low = low;
+        ret.high = count == 3 ? After(low - low % MINOR, 2) : after;
+        return true;
+      case '^':
+        ret.low = low;
+        if (count == 0) ret.high = MAX;
+        else if (parts[0] || count == 1) ret.high = After(low - low % MAJOR, 1);
+        else if (parts[1] || count == 2) ret.high = After(low - low % MINOR, 2);
+        else ret.high = low + 1;
+        return true;
+    }
+
+    // Plain partial, maybe the start of a hyphen range ("1.2 - 2")
+    ret.low = low;
+    ret.high = after;
+    if (equal) return true;
+    const char* p = scanner.p;
+    scanner.Spaces();
+    if (scanner.p == p || !scanner.Accept('-') || !scanner.Peek(' ')) {
+      scanner.p = p;
+      return true;
+    }
+    scanner.Spaces();
+    if (!scanner.Partial(parts, count)) return false;
+    ret.high = After(Version::Pack(parts[0], parts[1], parts[2]), count);
+    return true;
+  }
+
+  std::vector<Interval> intervals_;
+};
+V8_POST_TYPE(VersionRange)
+
+inline bool Version::satisfies(const VersionRange& range) const {
+  return range.test(key_);
+}
+
+inline V8_CB(Version::Satisfies) {
+  V8_M_SELF(Version);
+  VersionRange scratch;
+  const VersionRange* range = VersionRange::From(info[0], scratch);
+  if (!range) V8_STHROW(v8u::TypeErr("Invalid version range."));
+  V8_RET(Bool(range->test(inst->key_)));
+} V8_CB_END()
+
+inline V8_CB(Version::Filter) {
+  const char* data;
+  size_t count;
+  if (!KeysOf(info[0], data, count))
+    V8_STHROW(v8u::TypeErr("Buffer of version keys expected."));
+  VersionRange scratch;
+  const VersionRange* range = VersionRange::From(info[1], scratch);
+  if (!range) V8_STHROW(v8u::TypeErr("Invalid version range."));
+
+  std::vector<uint32_t> matches;
+  for (size_t i = 0; i < count; i++)
+    if (range->test(KeyAt(data, i))) matches.push_back(i);
+  v8::Local<v8::Array> ret = Arr(matches.size());
+  for (size_t i = 0; i < matches.size(); i++)
+    ret->Set(i, v8::Integer::NewFromUnsigned(matches[i]));
+  V8_RET(ret);
+} V8_CB_END()
+
+inline V8_CB(Version::FilterKeys) {
+  const char* data;
+  size_t count;
+  if (!KeysOf(info[0], data, count))
+    V8_STHROW(v8u::TypeErr("Buffer of version keys expected."));
+  VersionRange scratch;
+  const VersionRange* range = VersionRange::From(info[1], scratch);
+  if (!range) V8_STHROW(v8u::TypeErr("Invalid version range."));
+
+  std::vector<uint64_t> keys;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t key = KeyAt(data, i);
+    if (range->test(key)) keys.push_back(key);
+  }
+  V8_RET(KeysBuffer(keys));
+} V8_CB_END()
+
 };
 
 #endif	/* V8U_VERSION_HPP */